@@ -3,6 +3,20 @@
 
 #include "vasm.h"
 
+mempool atom_pool = MEMPOOL("atoms",sizeof(atom));
+mempool operand_pool = MEMPOOL("operands",sizeof(operand));
+unsigned long atoms_added;
+
+
+void *atom_alloc(size_t sz)
+/* Atoms and their payloads are carved from a block of the current section,
+   so each section's atoms are adjacent in memory, even when the source
+   switches sections frequently. Their memory is never freed. */
+{
+  return pool_carve(&atom_pool,current_section?&current_section->atoms:
+                                               &container_section.atoms,sz);
+}
+
 
 /* searches mnemonic list and tries to parse (via the cpu module)
    the operands according to the mnemonic requirements; returns an
@@ -111,13 +125,13 @@ instruction *new_inst(const char *inst,int len,
       }
 
       /* Matched! Create instruction and copy operands. */
-      new = mymalloc(sizeof(*new));
+      new = atom_alloc(sizeof(*new));
 #if HAVE_INSTRUCTION_EXTENSION
       init_instruction_ext(&new->ext);
 #endif
       mnemo_opcnt -= skipped;
       for (j=0; j<mnemo_opcnt; j++) {
-        new->op[j] = mymalloc(sizeof(operand));
+        new->op[j] = pool_alloc(&operand_pool);
         *new->op[j] = ops[j];
       }
       for(; j<MAX_OPERANDS; j++)
@@ -187,9 +201,21 @@ dblock *new_dblock(void)
 }
 
 
+static dblock *new_inline_dblock(size_t sz)
+/* dblock for an atom, with the data following it */
+{
+  dblock *db = atom_alloc(sizeof(dblock)+(sz?sz:1));
+
+  db->size = sz;
+  db->data = (unsigned char *)(db + 1);
+  db->relocs = NULL;
+  return db;
+}
+
+
 sblock *new_sblock(expr *space,size_t size,expr *fill)
 {
-  sblock *sb = mymalloc(sizeof(sblock));
+  sblock *sb = atom_alloc(sizeof(sblock));
 
   sb->space = 0;
   sb->space_exp = space;
@@ -218,9 +244,10 @@ static size_t space_size(sblock *sb,section *sec,taddr pc)
       symbol *base=NULL;
       taddr fill;
       utaddr i;
+      int btype;
 
-      if (!eval_expr(sb->fill_exp,&fill,sec,pc)) {
-        if (find_base(sb->fill_exp,&base,sec,pc)==BASE_ILLEGAL)
+      if (!eval_expr_base(sb->fill_exp,&fill,&base,&btype,sec,pc)) {
+        if (btype==BASE_ILLEGAL)
           general_error(38);  /* illegal relocation */
       }
       copy_cpu_taddr(sb->fill,fill,sb->size);
@@ -258,6 +285,7 @@ static size_t roffs_size(reloffs *roffs,section *sec,taddr pc)
 
 static void internal_add_atom(section *sec,atom *a)
 {
+  atoms_added++;
   a->changes = 0;
   a->src = cur_src;
   a->line = cur_src!=NULL ? cur_src->line : 0;
@@ -299,6 +327,8 @@ static void internal_add_atom(section *sec,atom *a)
    if the current section doesn't exist, then a default section is created */
 void add_atom(section *sec,atom *a)
 {
+  if (inccache_recording)
+    inccache_taint();  /* include files creating atoms are not cached */
   if (!sec) {
     sec = default_section();
     if (!sec) {
@@ -424,7 +454,7 @@ void print_atom(FILE *f,atom *p)
         fprintf(f,"none");
       break;
     case RORG:
-      fprintf(f,"rorg: relocate to 0x%llx",ULLTADDR(*p->content.rorg));
+      fprintf(f,"rorg: relocate to 0x%llx",ULLTADDR(p->content.rorg));
       break;
     case RORGEND:
       fprintf(f,"rorg end");
@@ -508,7 +538,7 @@ void atom_printexpr(printexpr *pexp,section *sec,taddr pc)
 
 atom *clone_atom(atom *a)
 {
-  atom *new = mymalloc(sizeof(atom));
+  atom *new = atom_alloc(sizeof(atom));
   void *p;
 
   memcpy(new,a,sizeof(atom));
@@ -517,12 +547,12 @@ atom *clone_atom(atom *a)
     /* INSTRUCTION and DATADEF have to be cloned as well, because they will
        be deallocated and transformed into DATA during assemble() */
     case INSTRUCTION:
-      p = mymalloc(sizeof(instruction));
+      p = atom_alloc(sizeof(instruction));
       memcpy(p,a->content.inst,sizeof(instruction));
       new->content.inst = p;
       break;
     case DATADEF:
-      p = mymalloc(sizeof(defblock));
+      p = atom_alloc(sizeof(defblock));
       memcpy(p,a->content.defb,sizeof(defblock));
       new->content.defb = p;
       break;
@@ -538,13 +568,136 @@ atom *clone_atom(atom *a)
 }
 
 
+#ifdef COPY_OPERAND
+static int same_operand(operand *a,operand *b)
+{
+  if (a==NULL || b==NULL)
+    return a == b;
+  return SAME_OPERAND(a,b);
+}
+
+
+static int same_string(const char *a,const char *b)
+{
+  if (a==NULL || b==NULL)
+    return a == b;
+  return !strcmp(a,b);
+}
+
+
+/* Returns true when both atoms have identical contents, so that one
+   could have been created by copy_atom() from the other. Only atoms
+   which copy_atom() supports are compared. */
+int same_atom(atom *a,atom *b)
+{
+  instruction *ia,*ib;
+  sblock *sa,*sb;
+  int i;
+
+  if (a->type!=b->type || a->align!=b->align || a->lastsize!=b->lastsize)
+    return 0;
+
+  switch (a->type) {
+    case INSTRUCTION:
+      ia = a->content.inst;
+      ib = b->content.inst;
+      if (ia->code != ib->code)
+        return 0;
+#if MAX_QUALIFIERS!=0
+      for (i=0; i<MAX_QUALIFIERS; i++) {
+        if (!same_string(ia->qualifiers[i],ib->qualifiers[i]))
+          return 0;
+      }
+#endif
+#if MAX_OPERANDS!=0
+      for (i=0; i<MAX_OPERANDS; i++) {
+        if (!same_operand(ia->op[i],ib->op[i]))
+          return 0;
+      }
+#endif
+#if HAVE_INSTRUCTION_EXTENSION
+      if (!SAME_INSTRUCTION_EXT(&ia->ext,&ib->ext))
+        return 0;
+#endif
+      return 1;
+
+    case DATADEF:
+      return a->content.defb->bitsize==b->content.defb->bitsize &&
+             same_operand(a->content.defb->op,b->content.defb->op);
+
+    case DATA:
+      return a->content.db->relocs==NULL && b->content.db->relocs==NULL &&
+             a->content.db->size==b->content.db->size &&
+             !memcmp(a->content.db->data,b->content.db->data,
+                     a->content.db->size);
+
+    case SPACE:
+      sa = a->content.sb;
+      sb = b->content.sb;
+      return sa->relocs==NULL && sb->relocs==NULL &&
+             sa->size==sb->size && sa->flags==sb->flags &&
+             sa->maxalignbytes==sb->maxalignbytes &&
+             !memcmp(sa->fill,sb->fill,MAXPADBYTES) &&
+             same_expr(sa->space_exp,sb->space_exp) &&
+             same_expr(sa->fill_exp,sb->fill_exp);
+
+    default:
+      break;
+  }
+  return 0;
+}
+
+
+/* Makes a deep copy of an atom accepted by same_atom(), which does not
+   share any operands or expressions with the original. */
+atom *copy_atom(atom *a)
+{
+  atom *new = clone_atom(a);
+  instruction *ip;
+  dblock *db;
+  sblock *sb;
+  int i;
+
+  switch (a->type) {
+    case INSTRUCTION:
+      ip = new->content.inst;
+#if MAX_OPERANDS!=0
+      for (i=0; i<MAX_OPERANDS; i++) {
+        if (ip->op[i] != NULL)
+          ip->op[i] = COPY_OPERAND(ip->op[i]);
+      }
+#endif
+      break;
+    case DATADEF:
+      if (new->content.defb->op != NULL)
+        new->content.defb->op = COPY_OPERAND(new->content.defb->op);
+      break;
+    case DATA:
+      db = new_inline_dblock(a->content.db->size);
+      memcpy(db->data,a->content.db->data,db->size);
+      new->content.db = db;
+      break;
+    case SPACE:
+      sb = atom_alloc(sizeof(sblock));
+      memcpy(sb,a->content.sb,sizeof(sblock));
+      sb->space_exp = copy_tree(sb->space_exp);
+      sb->fill_exp = copy_tree(sb->fill_exp);
+      new->content.sb = sb;
+      break;
+    default:
+      ierror(0);
+      break;
+  }
+  return new;
+}
+#endif /* COPY_OPERAND */
+
+
 atom *add_data_atom(section *sec,size_t sz,taddr alignment,taddr c)
 {
-  dblock *db = new_dblock();
+  dblock *db = new_inline_dblock(sz);
   atom *a;
 
-  db->size = sz;
-  db->data = mymalloc(sz);
   if (sz > 1)
     setval(BIGENDIAN,db->data,sz,c);
   else
@@ -588,11 +741,9 @@ void add_sleb128_atom(section *sec,taddr c)
 
 atom *add_bytes_atom(section *sec,const void *p,size_t sz)
 {
-  dblock *db = new_dblock();
+  dblock *db = new_inline_dblock(sz);
   atom *a;
 
-  db->size = sz;
-  db->data = mymalloc(sz);
   memcpy(db->data,p,sz);
   a = new_data_atom(db,1);
   add_atom(sec,a);
@@ -602,7 +753,7 @@ atom *add_bytes_atom(section *sec,const void *p,size_t sz)
 
 atom *new_atom(int type,taddr align)
 {
-  atom *new = mymalloc(sizeof(*new));
+  atom *new = atom_alloc(sizeof(atom));
 
   new->next = NULL;
   new->type = type;
@@ -651,7 +802,7 @@ atom *new_datadef_atom(size_t bitsize,operand *op)
 {
   atom *new = new_atom(DATADEF,DATA_ALIGN(bitsize));
 
-  new->content.defb = mymalloc(sizeof(*new->content.defb));
+  new->content.defb = atom_alloc(sizeof(*new->content.defb));
   new->content.defb->bitsize = bitsize;
   new->content.defb->op = op;
   return new;
@@ -689,7 +840,7 @@ atom *new_expr_atom(expr *exp,int type,int size)
 {
   atom *new = new_atom(PRINTEXPR,1);
 
-  new->content.pexpr = mymalloc(sizeof(*new->content.pexpr));
+  new->content.pexpr = atom_alloc(sizeof(*new->content.pexpr));
   if (exp==NULL || type<PEXP_HEX || type>PEXP_ASC || size<1
       || size>sizeof(long long)*8)
     ierror(0);
@@ -704,7 +855,7 @@ atom *new_roffs_atom(expr *offs,expr *fill)
 {
   atom *new = new_atom(ROFFS,1);
 
-  new->content.roffs = mymalloc(sizeof(*new->content.roffs));
+  new->content.roffs = atom_alloc(sizeof(*new->content.roffs));
   new->content.roffs->offset = offs;
   new->content.roffs->fillval = fill;
   return new;
@@ -714,10 +865,8 @@ atom *new_roffs_atom(expr *offs,expr *fill)
 atom *new_rorg_atom(taddr raddr)
 {
   atom *new = new_atom(RORG,1);
-  taddr *newrorg = mymalloc(sizeof(taddr));
 
-  *newrorg = raddr;
-  new->content.rorg = newrorg;
+  new->content.rorg = raddr;
   return new;
 }
 
@@ -732,7 +881,7 @@ atom *new_assert_atom(expr *aexp,const char *exp,const char *msg)
 {
   atom *new = new_atom(ASSERT,1);
 
-  new->content.assert = mymalloc(sizeof(*new->content.assert));
+  new->content.assert = atom_alloc(sizeof(*new->content.assert));
   new->content.assert->assert_exp = aexp;
   new->content.assert->expstr = exp;
   new->content.assert->msgstr = msg;
@@ -744,7 +893,7 @@ atom *new_nlist_atom(const char *name,int type,int other,int desc,expr *value)
 {
   atom *new = new_atom(NLIST,1);
 
-  new->content.nlist = mymalloc(sizeof(*new->content.nlist));
+  new->content.nlist = atom_alloc(sizeof(*new->content.nlist));
   new->content.nlist->name = name;
   new->content.nlist->type = type;
   new->content.nlist->other = other;
@@ -91,16 +91,14 @@ typedef struct aoutnlist {
   expr *value;
 } aoutnlist;
 
-/* an atomic element of data */
+/* An atomic element of data. Atoms are carved from the blocks of the section
+   they are created in (see atom_alloc()), usually right behind their payload,
+   so the resolver streams through memory when following a section's list.
+   Pointer-sized fields come first and the narrow ones are packed at the end,
+   which keeps the atom at 56 bytes on 64-bit hosts. */
 struct atom {
   struct atom *next;
-  int type;
-  taddr align;
   size_t lastsize;
-  unsigned changes;
-  source *src;
-  int line;
-  listing *list;
   union {
     instruction *inst;
     dblock *db;
@@ -112,10 +110,16 @@ struct atom {
     const char *ptext;
     printexpr *pexpr;
     reloffs *roffs;
-    taddr *rorg;
+    taddr rorg;
     assertion *assert;
     aoutnlist *nlist;
   } content;
+  source *src;
+  listing *list;
+  taddr align;
+  int line;
+  unsigned char type;
+  unsigned char changes;  /* saturates at MAXSIZECHANGES+1 */
 };
 
 #define MAXSIZECHANGES 5  /* warning, when atom changed size so many times */
@@ -128,6 +132,10 @@ instruction *copy_inst(instruction *);
 dblock *new_dblock();
 sblock *new_sblock(expr *,size_t,expr *);
 
+extern mempool atom_pool,operand_pool;
+extern unsigned long atoms_added;
+
+void *atom_alloc(size_t);
 atom *new_atom(int,taddr);
 void add_atom(section *,atom *);
 void add_or_save_atom(atom *);
@@ -135,6 +143,10 @@ size_t atom_size(atom *,section *,taddr);
 void print_atom(FILE *,atom *);
 void atom_printexpr(printexpr *,section *,taddr);
 atom *clone_atom(atom *);
+#ifdef COPY_OPERAND
+int same_atom(atom *,atom *);
+atom *copy_atom(atom *);
+#endif
 
 atom *add_data_atom(section *,size_t,taddr,taddr);
 void add_leb128_atom(section *,taddr);
@@ -4,6 +4,7 @@
 #include "vasm.h"
 
 int clev;  /* conditional level */
+unsigned long cond_calls;  /* number of conditional directives seen */
 
 static signed char cond[MAXCONDLEV+1];
 static char *condsrc[MAXCONDLEV+1];
@@ -37,6 +38,7 @@ void cond_check(void)
 /* establish a new level of conditional assembly */
 void cond_if(char flag)
 {
+  cond_calls++;
   if (++clev >= MAXCONDLEV)
     general_error(65,clev);  /* nesting depth exceeded */
 
@@ -49,6 +51,7 @@ void cond_if(char flag)
 /* handle skipped if statement */
 void cond_skipif(void)
 {
+  cond_calls++;
   ifnesting++;
 }
 
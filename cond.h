@@ -11,6 +11,7 @@
 
 /* global variables */
 extern int clev;
+extern unsigned long cond_calls;
 
 /* functions */
 void cond_init(void);
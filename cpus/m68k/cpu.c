@@ -35,9 +35,13 @@ int m68k_mid = 1;                     /* default a.out MID: 68000/68010 */
 static hashtable *spechash;
 static hashtable *movchash;
 
-static uint32_t cpu_type = m68000;
+/* The options set by cpu_opts() are thread-local. Worker threads resolve
+   sections and evaluate atoms with the OPTS atoms of their own section. */
+#define CPUOPT static THREADLOCAL
+
+CPUOPT uint32_t cpu_type = m68000;
 static expr *baseexp[7];              /* basereg: expression loaded to reg. */
-static signed char sdreg = -1;        /* current small-data base register */
+CPUOPT signed char sdreg = -1;        /* current small-data base register */
 static signed char last_sdreg = -1;
 static unsigned char optmainswitch = 1;
 static unsigned char phxass_compat = 0;
@@ -46,40 +50,40 @@ static unsigned char gas = 0;         /* true enables GNU-as mnemonics */
 static unsigned char sgs = 0;         /* true enables & as immediate prefix */
 static unsigned char no_fpu = 0;      /* true: FPU code/direct. disallowed */
 static unsigned char elfregs = 0;     /* true: %Rn instead of Rn reg. names */
-static unsigned char fpu_id = 1;      /* default coprocessor id for FPU */
-static unsigned char opt_gen = 1;     /* generic optimizations (not Devpac) */
-static unsigned char opt_movem = 0;   /* MOVEM Rn -> MOVE Rn */
-static unsigned char opt_pea = 0;     /* MOVE.L #x,-(sp) -> PEA x */
-static unsigned char opt_clr = 0;     /* MOVE #0,<ea> -> CLR <ea> */
-static unsigned char opt_st = 0;      /* MOVE.B #-1,<ea> -> ST <ea> */
-static unsigned char opt_lsl = 0;     /* LSL #1,Dn -> ADD Dn,Dn */
-static unsigned char opt_mul = 0;     /* MULU/MULS #n,Dn -> LSL/ASL #n,Dn */
-static unsigned char opt_div = 0;     /* DIVU/DIVS.L #n,Dn -> LSR/ASR #n,Dn */
-static unsigned char opt_fconst = 1;  /* Fxxx.D #m,FPn -> Fxxx.S #m,FPn */
-static unsigned char opt_brajmp = 0;  /* branch to different sect. into jump */
-static unsigned char opt_pc = 1;      /* <label> -> (<label>,PC) */
-static unsigned char opt_bra = 1;     /* B<cc>.L -> B<cc>.W -> B<cc>.B */
+CPUOPT unsigned char fpu_id = 1;      /* default coprocessor id for FPU */
+CPUOPT unsigned char opt_gen = 1;     /* generic optimizations (not Devpac) */
+CPUOPT unsigned char opt_movem = 0;   /* MOVEM Rn -> MOVE Rn */
+CPUOPT unsigned char opt_pea = 0;     /* MOVE.L #x,-(sp) -> PEA x */
+CPUOPT unsigned char opt_clr = 0;     /* MOVE #0,<ea> -> CLR <ea> */
+CPUOPT unsigned char opt_st = 0;      /* MOVE.B #-1,<ea> -> ST <ea> */
+CPUOPT unsigned char opt_lsl = 0;     /* LSL #1,Dn -> ADD Dn,Dn */
+CPUOPT unsigned char opt_mul = 0;     /* MULU/MULS #n,Dn -> LSL/ASL #n,Dn */
+CPUOPT unsigned char opt_div = 0;     /* DIVU/DIVS.L #n,Dn -> LSR/ASR #n,Dn */
+CPUOPT unsigned char opt_fconst = 1;  /* Fxxx.D #m,FPn -> Fxxx.S #m,FPn */
+CPUOPT unsigned char opt_brajmp = 0;  /* branch to different sect. into jump */
+CPUOPT unsigned char opt_pc = 1;      /* <label> -> (<label>,PC) */
+CPUOPT unsigned char opt_bra = 1;     /* B<cc>.L -> B<cc>.W -> B<cc>.B */
 static unsigned char opt_allbra = 0;  /* also optimizes sized branches */
-static unsigned char opt_jbra = 0;    /* JMP/JSR <ext> -> BRA.L/BSR.L (020+) */
-static unsigned char opt_disp = 1;    /* (0,An) -> (An), etc. */
-static unsigned char opt_abs = 1;     /* optimize absolute addresses to 16bit */
-static unsigned char opt_moveq = 1;   /* MOVE.L #x,Dn -> MOVEQ #x,Dn */
-static unsigned char opt_nmovq = 0;   /* MOVE.L #x,Dn -> MOVEQ #x,Dn & NEG Dn*/
-static unsigned char opt_quick = 1;   /* ADD/SUB #x,Rn -> ADDQ/SUBQ #x,Rn */
-static unsigned char opt_branop = 1;  /* BRA.B *+2 -> NOP */
-static unsigned char opt_bdisp = 1;   /* base displacement optimization */
-static unsigned char opt_odisp = 1;   /* outer displacement optimization */
-static unsigned char opt_lea = 1;     /* ADD/SUB #x,An -> LEA (x,An),An */
-static unsigned char opt_lquick = 1;  /* LEA (x,An),An -> ADDQ/SUBQ #x,An */
-static unsigned char opt_immaddr = 1; /* <op>.L #x,An -> <op>.W #x,An */
-static unsigned char opt_speed = 0;   /* optimize for speed, code may grow */
-static unsigned char opt_size = 0;    /* optimize for size, even when slower */
-static unsigned char opt_sc = 0;      /* external JMP/JSR are 16-bit PC-rel. */
-static unsigned char opt_sd = 0;      /* small data opts: abs.L -> (d16,An) */
-static unsigned char no_opt = 0;      /* don't optimize at all! */
-static unsigned char warn_opts = 0;   /* warn on optimizations/translations */
+CPUOPT unsigned char opt_jbra = 0;    /* JMP/JSR <ext> -> BRA.L/BSR.L (020+) */
+CPUOPT unsigned char opt_disp = 1;    /* (0,An) -> (An), etc. */
+CPUOPT unsigned char opt_abs = 1;     /* optimize absolute addresses to 16bit */
+CPUOPT unsigned char opt_moveq = 1;   /* MOVE.L #x,Dn -> MOVEQ #x,Dn */
+CPUOPT unsigned char opt_nmovq = 0;   /* MOVE.L #x,Dn -> MOVEQ #x,Dn & NEG Dn*/
+CPUOPT unsigned char opt_quick = 1;   /* ADD/SUB #x,Rn -> ADDQ/SUBQ #x,Rn */
+CPUOPT unsigned char opt_branop = 1;  /* BRA.B *+2 -> NOP */
+CPUOPT unsigned char opt_bdisp = 1;   /* base displacement optimization */
+CPUOPT unsigned char opt_odisp = 1;   /* outer displacement optimization */
+CPUOPT unsigned char opt_lea = 1;     /* ADD/SUB #x,An -> LEA (x,An),An */
+CPUOPT unsigned char opt_lquick = 1;  /* LEA (x,An),An -> ADDQ/SUBQ #x,An */
+CPUOPT unsigned char opt_immaddr = 1; /* <op>.L #x,An -> <op>.W #x,An */
+CPUOPT unsigned char opt_speed = 0;   /* optimize for speed, code may grow */
+CPUOPT unsigned char opt_size = 0;    /* optimize for size, even when slower */
+CPUOPT unsigned char opt_sc = 0;      /* external JMP/JSR are 16-bit PC-rel. */
+CPUOPT unsigned char opt_sd = 0;      /* small data opts: abs.L -> (d16,An) */
+CPUOPT unsigned char no_opt = 0;      /* don't optimize at all! */
+CPUOPT unsigned char warn_opts = 0;   /* warn on optimizations/translations */
 static unsigned char convert_brackets = 0;  /* convert [ into ( for <020 */
-static unsigned char typechk = 1;     /* check value types and ranges */
+CPUOPT unsigned char typechk = 1;     /* check value types and ranges */
 static unsigned char ign_unambig_ext = 0;  /* don't check unambig. size ext. */
 static unsigned char ign_unsized_ext = 0;  /* don't check size on unsized */
 static unsigned char regsymredef = 0; /* allow redefinition of reg. symbols */
@@ -89,8 +93,8 @@ static unsigned char extsd = 0;       /* small-data with ext. addr. modes */
 static char current_ext;              /* extension of current parsed inst. */
 
 /* minimum and maximum distance+1 for B<cc>.B branches */
-static taddr bmin = -0x80;
-static taddr bmax = 0x80;
+CPUOPT taddr bmin = -0x80;
+CPUOPT taddr bmax = 0x80;
 
 static char b_str[] = "b";
 static char w_str[] = "w";
@@ -173,14 +177,14 @@ static struct {
    The ipslot has to be reset to 0, before using copy_instruction(),
    ip_singleop() and ip_dualop(). */
 #define MAX_IP_COPIES 4
-static int ipslot;
-static instruction newip[MAX_IP_COPIES];
-static operand newop[MAX_IP_COPIES][MAX_OPERANDS];
+CPUOPT int ipslot;
+CPUOPT instruction newip[MAX_IP_COPIES];
+CPUOPT operand newop[MAX_IP_COPIES][MAX_OPERANDS];
 
 
 operand *new_operand(void)
 {
-  return mycalloc(sizeof(operand));
+  return memset(pool_alloc(&operand_pool),0,sizeof(operand));
 }
 
 
@@ -200,7 +204,7 @@ static void free_operand(operand *op)
 {
   if (op) {
     free_op_exp(op);
-    myfree(op);
+    pool_free(&operand_pool,op);
   }
 }
 
@@ -217,6 +221,7 @@ void init_instruction_ext(instruction_ext *ixp)
   ixp->un.real.flags = 0;
   ixp->un.real.last_size = -1;
   ixp->un.real.orig_ext = -1;
+  ixp->memo.sec = NULL;
 }
 
 
@@ -289,6 +294,40 @@ int m68k_operand_optional(operand *op,int type)
 }
 
 
+int m68k_same_operand(operand *a,operand *b)
+/* Check if two parsed operands are identical. basetype, extval and base
+   are results of eval_oper() and not compared. */
+{
+  return a->mode==b->mode && a->reg==b->reg && a->format==b->format &&
+         a->bf_offset==b->bf_offset && a->bf_width==b->bf_width &&
+         a->flags==b->flags &&
+         same_expr(a->value[0],b->value[0]) &&
+         same_expr(a->value[1],b->value[1]);
+}
+
+
+operand *m68k_copy_operand(operand *op)
+/* Make a copy of an operand with its own expressions. */
+{
+  operand *new = pool_alloc(&operand_pool);
+
+  *new = *op;
+  new->value[0] = copy_tree(op->value[0]);
+  new->value[1] = copy_tree(op->value[1]);
+  return new;
+}
+
+
+int m68k_same_instruction_ext(instruction_ext *a,instruction_ext *b)
+/* Check if two instructions were left in the same state by parsing
+   and by the optimizer. The size memo is not compared. */
+{
+  return a->un.real.flags==b->un.real.flags &&
+         a->un.real.last_size==b->un.real.last_size &&
+         a->un.real.orig_ext==b->un.real.orig_ext;
+}
+
+
 static int phxass_cpu_num(uint32_t type)
 {
   static const int cpus[] = {
@@ -1545,7 +1584,11 @@ static int fix_basereg(operand *op,int final)
 
   if (op->value[0]!=NULL && (left=op->value[0]->left)!=NULL) {
     if (eval_expr(left,&val,NULL,0)) {
-      /* Kill the subtrahend of the base-relative expression. */
+      /* Kill the subtrahend of the base-relative expression. A worker
+         thread must not modify the shared expression, so it leaves this
+         to the serial pass. */
+      if (final && error_trap)
+        longjmp(*error_trap,1);
       if (final) {
         op->value[0]->left = NULL;
         free_expr(op->value[0]);
@@ -1602,6 +1645,7 @@ int parse_operand(char *p,int len,operand *op,int required)
   op->mode = op->reg = -1;
   op->flags = 0;
   op->format = 0;
+  op->bf_offset = op->bf_width = 0;
   op->value[0] = op->value[1] = NULL;
   p = skip(p);
   if (convert_brackets && !(cpu_type & (m68020up|cpu32|mcf))) {
@@ -2199,14 +2243,15 @@ int parse_operand(char *p,int len,operand *op,int required)
 static void eval_oper(operand *op,section *sec,taddr pc,int final)
 /* evaluate operand expression */
 {
-  int i;
+  int i,btype;
 
   for (i=0; i<2; i++) {
     op->base[i] = NULL;
     if (type_of_expr(op->value[i]) == NUM) {
 eval:
-      if (!eval_expr(op->value[i],&op->extval[i],sec,pc)) {
-        op->basetype[i] = find_base(op->value[i],&op->base[i],sec,pc);
+      if (!eval_expr_base(op->value[i],&op->extval[i],&op->base[i],&btype,
+                          sec,pc)) {
+        op->basetype[i] = btype;
 
         if (op->basetype[i] == BASE_ILLEGAL) {
           if (op->flags & FL_BaseReg) {
@@ -2951,10 +2996,18 @@ dontswap:
 
     if (!eval_expr(rlexp,&val,NULL,0) && final)
       general_error(30);  /* expression must be constant */
-    movemregs->expr = rlexp;
-    if (movemsize->expr->type != NUM)
-      ierror(0);
-    movemsize->expr->c.val = ext=='w' ? 2 : 4;
+    if (error_trap) {
+      /* worker thread: the symbols are shared and assigned in source
+         order, so a MOVEM is left to the serial pass when they are used */
+      if ((movembytes->flags|movemregs->flags) & USED)
+        longjmp(*error_trap,1);
+    }
+    else {
+      movemregs->expr = rlexp;
+      if (movemsize->expr->type != NUM)
+        ierror(0);
+      movemsize->expr->c.val = ext=='w' ? 2 : 4;
+    }
   }
 
   if (no_opt)
@@ -4289,6 +4342,38 @@ static size_t iplist_size(instruction *ip)
 }
 
 
+static int memo_key(instruction *ip,section *sec,taddr pc,
+                    taddr *val,symbol **base,signed char *btype)
+/* Evaluate the operand expressions, which the optimization of an instruction
+   depends on. Returns their number, or -1 when there are too many.
+   A displacement to a label of the same relocatable section is only used
+   as a distance, so it is keyed relative to pc and stays valid when the
+   instruction moves. Small data (sdreg>=0) needs the label's offset. */
+{
+  operand *op;
+  int i,j,n=0;
+
+  for (i=0; i<MAX_OPERANDS && (op=ip->op[i])!=NULL; i++) {
+    if (op->flags & FL_DoNotEval)
+      continue;
+    for (j=0; j<2; j++) {
+      if (type_of_expr(op->value[j]) == NUM) {
+        int bt;
+
+        if (n >= MEMOVALS)
+          return -1;
+        eval_expr_base(op->value[j],&val[n],&base[n],&bt,sec,pc);
+        if (j==0 && sdreg<0 && !(sec->flags & ABSOLUTE) &&
+            base[n]!=NULL && LOCREF(base[n]) && base[n]->sec==sec)
+          val[n] -= pc;
+        btype[n++] = bt;
+      }
+    }
+  }
+  return n;
+}
+
+
 size_t instruction_size(instruction *realip,section *sec,taddr pc)
 /* Calculate the size of the current instruction; must be identical
    to the data created by eval_instruction. */
@@ -4301,6 +4386,11 @@ size_t instruction_size(instruction *realip,section *sec,taddr pc)
   instruction *ip;
   unsigned char extflags;
   uint16_t extsize;
+  taddr val[MEMOVALS];
+  symbol *base[MEMOVALS];
+  signed char btype[MEMOVALS];
+  int nvals;
+  taddr mpc;
 
   /* check if current mnemonic is valid for selected cpu-type */
   while (!(mnemo->ext.available & cpu_type)) {
@@ -4459,6 +4549,34 @@ size_t instruction_size(instruction *realip,section *sec,taddr pc)
     realip->code++;
   }
 
+  /* Reuse the size from the last call, when the optimizer would see
+     exactly the same input again. Not in the final pass, where the
+     optimizer may also emit warnings. Only absolute sections depend
+     on the pc itself, otherwise the memo survives moving code. */
+  nvals = final_pass ? -1 : memo_key(realip,sec,pc,val,base,btype);
+  mpc = (sec->flags & ABSOLUTE) ? pc : 0;
+  if (nvals >= 0 && realip->ext.memo.sec == sec) {
+    if (realip->ext.memo.pc == mpc &&
+        realip->ext.memo.secflags == sec->flags &&
+        realip->ext.memo.code == realip->code &&
+        realip->ext.memo.nvals == nvals &&
+        realip->ext.memo.ipflags == realip->ext.un.real.flags &&
+        realip->ext.memo.last_size == realip->ext.un.real.last_size) {
+      for (i=0; i<nvals; i++) {
+        if (realip->ext.memo.val[i] != val[i] ||
+            realip->ext.memo.base[i] != base[i] ||
+            realip->ext.memo.btype[i] != btype[i])
+          break;
+      }
+      if (i == nvals) {
+        size = realip->ext.memo.size;
+        if (!(realip->ext.memo.extflags & IFL_RETAINLASTSIZE))
+          realip->ext.un.real.last_size = size;
+        return size;
+      }
+    }
+  }
+
   /* do optimizations on a copy of the current instruction */
   ipslot = 0;
   ip = copy_instruction(realip);
@@ -4466,6 +4584,27 @@ size_t instruction_size(instruction *realip,section *sec,taddr pc)
 
   /* and determine current size (from optimized copy) */
   size = iplist_size(ip);
+
+  if (nvals >= 0) {
+    /* remember inputs and result for the next pass */
+    realip->ext.memo.sec = sec;
+    realip->ext.memo.pc = mpc;
+    realip->ext.memo.secflags = sec->flags;
+    realip->ext.memo.code = realip->code;
+    realip->ext.memo.nvals = nvals;
+    realip->ext.memo.ipflags = realip->ext.un.real.flags;
+    realip->ext.memo.last_size = realip->ext.un.real.last_size;
+    for (i=0; i<nvals; i++) {
+      realip->ext.memo.val[i] = val[i];
+      realip->ext.memo.base[i] = base[i];
+      realip->ext.memo.btype[i] = btype[i];
+    }
+    realip->ext.memo.extflags = extflags;
+    realip->ext.memo.size = size;
+  }
+  else
+    realip->ext.memo.sec = NULL;
+
   if (!(extflags & IFL_RETAINLASTSIZE))
     realip->ext.un.real.last_size = size;  /* remember size for next pass */
 
@@ -5373,7 +5512,8 @@ eval_done:
   /* restore flags and last_size of real ip to allow instruction_size() */
   realip->ext.un.real.flags = ipflags;
   realip->ext.un.real.last_size = lastsize;
-  typechk = oldtypechk;
+  if (ipflags & IFL_NOTYPECHK)
+    typechk = oldtypechk;
 
   return db;
 }
@@ -5403,8 +5543,7 @@ dblock *eval_data(operand *op,size_t bitsize,section *sec,taddr pc)
     etype = HUG;
   }
   else {
-    if (!eval_expr(op->value[0],&val,sec,pc)) {
-      btype = find_base(op->value[0],&base,sec,pc);
+    if (!eval_expr_base(op->value[0],&val,&base,&btype,sec,pc)) {
       if (btype == BASE_ILLEGAL)
         general_error(38);  /* illegal relocation */
     }
@@ -25,6 +25,7 @@ typedef uint32_t utaddr;
 
 /* instruction extension */
 #define HAVE_INSTRUCTION_EXTENSION 1
+#define MEMOVALS 2  /* max. number of operand expressions in a size memo */
 typedef struct {
   union {
     struct {
@@ -37,6 +38,20 @@ typedef struct {
       struct instruction *next;
     } copy;
   } un;
+  struct {  /* last result of instruction_size() and its inputs */
+    section *sec;             /* NULL when invalid */
+    taddr pc;                 /* 0 in relocatable sections */
+    uint32_t secflags;
+    int code;
+    taddr val[MEMOVALS];      /* operand expression values */
+    symbol *base[MEMOVALS];
+    signed char btype[MEMOVALS];
+    unsigned char nvals;
+    unsigned char ipflags;
+    signed char last_size;
+    unsigned char extflags;   /* result of optimize_instruction() */
+    unsigned char size;
+  } memo;
 } instruction_ext;
 #define IFL_RETAINLASTSIZE    1   /* retain current last_size value */
 #define IFL_UNSIZED           2   /* instruction had no size extension */
@@ -45,6 +60,10 @@ typedef struct {
 
 /* we use OPTS atoms for cpu-specific options */
 #define HAVE_CPU_OPTS 1
+
+/* instruction_size(), eval_instruction() and eval_data() may run in worker
+   threads, instruction_size() only modifies the instruction it is given */
+#define HAVE_THREADSAFE_EVAL 1
 typedef struct {
   int cmd;
   int arg;
@@ -105,6 +124,11 @@ enum {
 /* returns true when operand type is optional; may init default operand */
 #define OPERAND_OPTIONAL(p,t) m68k_operand_optional(p,t)
 
+/* compare and copy parsed operands, to replicate invariant repeat-blocks */
+#define SAME_OPERAND(a,b) m68k_same_operand(a,b)
+#define COPY_OPERAND(o) m68k_copy_operand(o)
+#define SAME_INSTRUCTION_EXT(a,b) m68k_same_instruction_ext(a,b)
+
 /* parse cpu-specific directives with label */
 #define PARSE_CPU_LABEL(l,s) parse_cpu_label(l,s)
 
@@ -456,4 +480,7 @@ extern int m68k_mid;
 int m68k_available(int);
 int m68k_data_operand(int);
 int m68k_operand_optional(operand *,int);
+int m68k_same_operand(operand *,operand *);
+operand *m68k_copy_operand(operand *);
+int m68k_same_instruction_ext(instruction_ext *,instruction_ext *);
 int parse_cpu_label(char *,char **);
@@ -26,10 +26,16 @@ static struct err_out output_err_out[]={
 static const int output_errors=sizeof(output_err_out)/sizeof(output_err_out[0]);
 
 int errors,warnings;  /* count */
+unsigned long error_calls;  /* including suppressed ones */
+
+/* Set by a worker thread while it evaluates an atom. Messages make it
+   longjmp() there, so the atom is evaluated again by the serial pass,
+   which reports them in source order. */
+THREADLOCAL jmp_buf *error_trap;
 
 /* options */
 int max_errors=5;
-int no_warn;
+THREADLOCAL int no_warn;
 
 
 static void print_source_line(FILE *f)
@@ -96,6 +102,16 @@ static void error(int n,va_list vl,struct err_out *errlist,int offset)
   FILE *f;
   int flags=errlist[n].flags;
 
+  if (error_trap) {
+    /* worker thread: the serial pass evaluates the atom again and
+       reports the message in source order; ignored messages are ignored */
+    if (!(flags&DISABLED) && !((flags&WARNING) && no_warn))
+      longjmp(*error_trap,1);
+    return;
+  }
+  error_calls++;
+  if (inccache_recording)
+    inccache_taint();
   if ((flags&DISABLED) || ((flags&WARNING) && no_warn))
     return;
 
@@ -6,12 +6,32 @@
 char current_pc_char='$';
 int unsigned_shift;
 
+/* when set, called for each label referenced during evaluation,
+   with a NULL pointer for the current pc */
+THREADLOCAL void (*record_symref)(symbol *);
+
+/* Set by a worker thread which resolves a section. add_dep() records
+   the sections referred to there, as their deps are shared. */
+THREADLOCAL bvtype *res_refs;
+
+/* Values of EXPRESSION symbols are cached while symval_epoch is non-zero.
+   It has to be incremented whenever a label changes its value. */
+unsigned long symval_epoch;
+
+/* 1: evaluate compiled expressions, 2: also cross-check with the tree */
+int compile_exprs;
+static THREADLOCAL int eval_pcdep;  /* last evaluation depended on pc */
+static THREADLOCAL int eval_depth;  /* nested symbols in a worker thread */
+#define MAXEVALDEPTH 1000  /* deeper nesting is left to the serial pass */
+
+static mempool expr_pool = MEMPOOL("expressions",sizeof(expr));
 static char *s;
 static symbol *cpc;
 static int make_tmp_lab;
 static int exp_type;
 
 static expr *expression();
+static void uncompile_expr(expr *);
 
 
 #ifndef EXPSKIP
@@ -26,14 +46,14 @@ static char *expskip(char *s)
 
 expr *new_expr(void)
 {
-  expr *new=mymalloc(sizeof(*new));
+  expr *new=pool_alloc(&expr_pool);
   new->left=new->right=0;
   return new;
 }
 
 expr *make_expr(int type,expr *left,expr *right)
 {
-  expr *new=mymalloc(sizeof(*new));
+  expr *new=pool_alloc(&expr_pool);
   new->left=left;
   new->right=right;
   new->type=type;
@@ -50,6 +70,35 @@ expr *copy_tree(expr *old)
   return new;
 }
 
+/* returns true when both trees have the same structure, constants
+   and symbols */
+int same_expr(expr *a,expr *b)
+{
+  if(a==b)
+    return 1;
+  if(!a||!b||a->type!=b->type)
+    return 0;
+  switch(a->type){
+    case NUM:
+      if(a->c.val!=b->c.val)
+        return 0;
+      break;
+    case HUG:
+      if(a->c.huge.hi!=b->c.huge.hi||a->c.huge.lo!=b->c.huge.lo)
+        return 0;
+      break;
+    case FLT:
+      if(a->c.flt!=b->c.flt)
+        return 0;
+      break;
+    case SYM:
+      if(a->c.sym!=b->c.sym)
+        return 0;
+      break;
+  }
+  return same_expr(a->left,b->left)&&same_expr(a->right,b->right);
+}
+
 expr *new_sym_expr(symbol *sym)
 {
   expr *new=new_expr();
@@ -60,6 +109,8 @@ expr *new_sym_expr(symbol *sym)
 
 expr *curpc_expr(void)
 {
+  if(error_trap)
+    longjmp(*error_trap,1);  /* cpc is shared, leave it to the serial pass */
   if(!cpc){
     cpc=new_import(" *current pc dummy*");
     cpc->type=LABSYM;
@@ -70,7 +121,11 @@ expr *curpc_expr(void)
 
 static void update_curpc(expr *exp,section *sec,taddr pc)
 {
+  if(exp->c.sym==cpc)
+    eval_pcdep=1;
   if(exp->c.sym==cpc&&sec!=NULL){
+    if(error_trap)
+      longjmp(*error_trap,1);  /* cpc is shared, leave it to the serial pass */
     cpc->sec=sec;
     cpc->pc=pc;
     if(sec->flags&ABSOLUTE)
@@ -583,9 +638,42 @@ void free_expr(expr *tree)
 {
   if(!tree)
     return;
+  if(mem_log){
+    /* worker thread: tree may still be shared with the serial pass */
+    log_mem(ML_EXPR|ML_FREE,NULL,tree);
+    return;
+  }
   free_expr(tree->left);
   free_expr(tree->right);
-  myfree(tree);
+  if(tree->left||tree->right)
+    uncompile_expr(tree);
+  pool_free(&expr_pool,tree);
+}
+
+/* Mark an EXPRESSION symbol while its expression is evaluated, to detect
+   a recursive definition. A worker thread must not modify shared symbols,
+   so it counts the nesting depth instead. It also leaves internal symbols
+   to the serial pass, as cpu modules may redefine them for every atom. */
+static void enter_sym(symbol *sym)
+{
+  if(error_trap){
+    /* too deep may be recursive, the serial pass reports it */
+    if(++eval_depth>MAXEVALDEPTH||(sym->flags&VASMINTERN))
+      longjmp(*error_trap,1);
+  }
+  else{
+    if(sym->flags&INEVAL)
+      general_error(18,sym->name);
+    sym->flags|=INEVAL;
+  }
+}
+
+static void leave_sym(symbol *sym)
+{
+  if(error_trap)
+    eval_depth--;
+  else
+    sym->flags&=~INEVAL;
 }
 
 /* Return type of expression.
@@ -598,11 +686,9 @@ int type_of_expr(expr *tree)
     return 0;
   ltype=tree->type;
   if(ltype==SYM){
-    if(tree->c.sym->flags&INEVAL)
-      general_error(18,tree->c.sym->name);
-    tree->c.sym->flags|=INEVAL;
+    enter_sym(tree->c.sym);
     ltype=tree->c.sym->type==EXPRESSION?type_of_expr(tree->c.sym->expr):NUM;
-    tree->c.sym->flags&=~INEVAL;
+    leave_sym(tree->c.sym);
     return ltype;
   }else if(ltype==NUM||ltype==HUG||ltype==FLT)
     return ltype;
@@ -643,6 +729,7 @@ void simplify_expr(expr *tree)
   int type=0;
   if(!tree)
     return;
+  uncompile_expr(tree);  /* the tree may change shape */
   simplify_expr(tree->left);
   simplify_expr(tree->right);
   if(tree->type==SUB&&tree->right->type==SYM&&tree->left->type==SUB&&
@@ -958,8 +1045,66 @@ void simplify_expr(expr *tree)
   }
 }
 
+/* Returns true when the tree only consists of integer constants and
+   equates, which are already folded into constants. Divisions which would
+   fail are not foldable, to report the error on evaluation. */
+static int foldable_expr(expr *tree)
+{
+  taddr lval,rval;
+
+  if(tree==NULL)
+    return 1;
+  if(tree->type==SYM){
+    symbol *sym=tree->c.sym;
+    if(sym->type!=EXPRESSION||(sym->flags&INEVAL))
+      return 0;
+    sym->flags|=INEVAL;
+    if(foldable_expr(sym->expr)&&sym->expr->type!=NUM&&
+       eval_expr(sym->expr,&lval,NULL,0))
+      sym->expr=number_expr(lval);  /* old tree may still be referenced */
+    sym->flags&=~INEVAL;
+    return sym->expr->type==NUM;
+  }
+  if(tree->type==HUG||tree->type==FLT||
+     !foldable_expr(tree->left)||!foldable_expr(tree->right))
+    return 0;
+  if(tree->type==DIV||tree->type==MOD){
+    eval_expr(tree->left,&lval,NULL,0);
+    eval_expr(tree->right,&rval,NULL,0);
+    if(rval==0||(lval==taddrmin&&rval==-1))
+      return 0;
+  }
+  return 1;
+}
+
+/* Fold all equates, which only depend on constants and other equates,
+   into NUM expressions. These are left over from forward references,
+   which could not be simplified while parsing. Also clears all cached
+   symbol values. */
+void fold_equates(void)
+{
+  symbol *sym;
+  expr sym_expr;
+
+  sym_expr.type=SYM;
+  sym_expr.left=sym_expr.right=NULL;
+  for(sym=first_symbol;sym;sym=sym->next){
+    sym->cacheid=0;
+    if(sym->type==EXPRESSION&&sym->expr->type!=NUM){
+      sym_expr.c.sym=sym;
+      foldable_expr(&sym_expr);
+    }
+  }
+}
+
 static void add_dep(section *src, section *dest)
 {
+  if(error_trap){
+    /* worker thread: only the resolver needs them, see res_refs */
+    if(res_refs&&num_secs&&src!=NULL&&src!=dest)
+      BSET(res_refs,dest->idx);
+    return;
+  }
   if(num_secs&&src!=NULL&&src!=dest){
     if(debug&&(!dest->deps||!BTST(dest->deps,src->idx)))
       printf("sec %s might depend on %s\n",src->name,dest->name);
@@ -971,30 +1116,116 @@ static void add_dep(section *src, section *dest)
   }
 }
 
-/* Evaluate an expression using current values of all symbols.
-   Result is written to *result. The return value specifies
-   whether the result is constant (i.e. only depending on
-   constants or absolute symbols). */
-int eval_expr(expr *tree,taddr *result,section *sec,taddr pc)
+/* Nodes of the single-pass evaluator. Every node of an expression tree
+   evaluated by eval_expr() or find_base() gets an evnode, which remembers
+   its value, constness and base symbol, so that no subtree has to be
+   evaluated twice. The array is used like a stack, as evaluations may be
+   nested. Nodes are addressed by index, because the array may move. */
+struct evnode {
+  expr *tree;
+  taddr val;
+  symbol *base;
+  int cnst;         /* -1 when not evaluated yet */
+  int btype;        /* BASE_UNKNOWN when base was not determined yet */
+  int bset;         /* base was assigned while determining it */
+  int left,right;   /* index of operand nodes, -1 when not created yet */
+};
+#define BASE_UNKNOWN -2
+static THREADLOCAL struct evnode *evn;
+static THREADLOCAL int evtop,evmax;
+
+/* A compiled expression keeps the nodes of a tree in postfix order, with
+   the operands of each node as indices. It is evaluated by copying this
+   layout into evnodes and computing them in a loop. Compiled trees are
+   found in a hash table by the address of their root node, so the trees
+   themselves don't grow. */
+struct exprcode {
+  struct exprcode *next;  /* next in the same hash chain */
+  int n;
+  struct ecnode {
+    expr *tree;
+    int left,right;
+  } node[1];
+};
+#define ECROOT(c) ((c)->node[(c)->n-1].tree)
+#define ECTABSIZE 0x1000
+static struct exprcode **ectab;
+static size_t ecsize,ecused;
+
+static void ev_reserve(int n)
+{
+  if(evtop+n>evmax){
+    memlog *ml=mem_log;
+
+    mem_log=NULL;  /* the node array outlives the atom of a worker thread */
+    while(evtop+n>evmax){
+      evmax=evmax?evmax*2:256;
+      evn=myrealloc(evn,evmax*sizeof(struct evnode));
+    }
+    mem_log=ml;
+  }
+}
+
+static int ev_node(expr *tree)
+{
+  ev_reserve(1);
+  evn[evtop].tree=tree;
+  evn[evtop].cnst=-1;
+  evn[evtop].btype=BASE_UNKNOWN;
+  evn[evtop].left=evn[evtop].right=-1;
+  return evtop++;
+}
+
+static int ev_left(int n)
+{
+  if(evn[n].left<0){
+    int l=ev_node(evn[n].tree->left);
+    evn[n].left=l;
+  }
+  return evn[n].left;
+}
+
+static int ev_right(int n)
 {
+  if(evn[n].right<0){
+    int r=ev_node(evn[n].tree->right);
+    evn[n].right=r;
+  }
+  return evn[n].right;
+}
+
+static int ev_eval(int,section *,taddr);
+static int ev_base(int,section *,taddr);
+static int ev_root(expr *,section *,taddr);
+
+/* compute node n from its operands, which are already evaluated */
+static void ev_op(int n,section *sec,taddr pc)
+{
+  expr *tree=evn[n].tree;
   taddr val,lval,rval;
   symbol *lsym,*rsym;
-  int cnst=1,lbok,rbok;
+  int cnst=1,lbok,rbok,l=evn[n].left,r=evn[n].right;
 
-  if(!tree)
-    ierror(0);
-  if(tree->left&&!eval_expr(tree->left,&lval,sec,pc))
-    cnst=0;
-  if(tree->right&&!eval_expr(tree->right,&rval,sec,pc))
-    cnst=0;
+  if(tree->left){
+    lval=evn[l].val;
+    if(!evn[l].cnst)
+      cnst=0;
+  }
+  if(tree->right){
+    rval=evn[r].val;
+    if(!evn[r].cnst)
+      cnst=0;
+  }
 
   switch(tree->type){
   case ADD:
     val=(lval+rval);
     break;
   case SUB:
-    lbok=find_base(tree->left,&lsym,sec,pc)==BASE_OK;
-    rbok=find_base(tree->right,&rsym,sec,pc)==BASE_OK;
+    lbok=ev_base(l,sec,pc)==BASE_OK;
+    lsym=lbok?evn[l].base:NULL;
+    rbok=ev_base(r,sec,pc)==BASE_OK;
+    rsym=rbok?evn[r].base:NULL;
     if(cnst==0&&rbok&&LOCREF(rsym)){
       if(lbok&&LOCREF(lsym)&&lsym->sec==rsym->sec){
         /* l2-l1 is constant when both have a valid symbol-base, and both
@@ -1012,6 +1243,7 @@ int eval_expr(expr *tree,taddr *result,section *sec,taddr pc)
         }else{
           /* prepare a value which works with REL_PC */
           val=(pc-rval+lval-(lsym->sec?lsym->sec->org:0));
+          eval_pcdep=1;
           break;
         }
       }else if(!lbok&&(rsym->flags&ABSLABEL)){
@@ -1103,13 +1335,40 @@ int eval_expr(expr *tree,taddr *result,section *sec,taddr pc)
   case SYM:
     lsym=tree->c.sym;
     if(lsym->type==EXPRESSION){
-      if(lsym->flags&INEVAL)
-        general_error(18,lsym->name);
-      lsym->flags|=INEVAL;
-      cnst=eval_expr(lsym->expr,&val,sec,pc);
-      lsym->flags&=~INEVAL;
+      unsigned long olderrs;
+      int pcdep;
+      if(lsym->cacheid==symval_epoch&&lsym->cachesec==sec&&
+         symval_epoch&&!record_symref){
+        val=lsym->cacheval;
+        cnst=lsym->cachecnst;
+        break;
+      }
+      enter_sym(lsym);
+      pcdep=eval_pcdep;
+      eval_pcdep=0;
+      olderrs=error_calls;
+      if((l=evn[n].left)<0){
+        l=ev_root(lsym->expr,sec,pc);
+        evn[n].left=l;
+      }
+      else
+        l=ev_eval(l,sec,pc);
+      val=evn[l].val;
+      cnst=evn[l].cnst;
+      leave_sym(lsym);
+      /* remember the value, unless it depends on pc, or evaluation
+         had side effects which must be repeated */
+      if(symval_epoch&&!eval_pcdep&&!record_symref&&olderrs==error_calls){
+        lsym->cacheid=symval_epoch;
+        lsym->cachesec=sec;
+        lsym->cacheval=val;
+        lsym->cachecnst=cnst;
+      }
+      eval_pcdep|=pcdep;
     }else if(LOCREF(lsym)){
       update_curpc(tree,sec,pc);
+      if(record_symref)
+        record_symref(lsym==cpc?NULL:lsym);
       val=lsym->pc;
       cnst=lsym->sec==NULL?0:(lsym->sec->flags&UNALLOCATED)!=0;
       if(lsym->flags&ABSLABEL) cnst=1;
@@ -1142,7 +1401,276 @@ int eval_expr(expr *tree,taddr *result,section *sec,taddr pc)
 #endif
     ierror(0);
   }
-  *result=val;
+  evn[n].val=val;
+  evn[n].cnst=cnst;
+}
+
+/* evaluate node n, returns n */
+static int ev_eval(int n,section *sec,taddr pc)
+{
+  expr *tree=evn[n].tree;
+
+  if(!tree)
+    ierror(0);
+  if(evn[n].cnst>=0)
+    return n;
+  if(tree->left)
+    ev_eval(ev_left(n),sec,pc);
+  if(tree->right)
+    ev_eval(ev_right(n),sec,pc);
+  ev_op(n,sec,pc);
+  return n;
+}
+
+/* Determine the base symbol of node n, like find_base() describes it.
+   Operands are evaluated when needed. */
+static int ev_base(int n,section *sec,taddr pc)
+{
+  static symbol nobase;
+  expr *p=evn[n].tree;
+  symbol *base=&nobase,*pcsym;
+  int ret=BASE_ILLEGAL,l,r;
+
+  if(evn[n].btype!=BASE_UNKNOWN)
+    return evn[n].btype;
+#ifdef EXT_FIND_BASE
+  if(ret=EXT_FIND_BASE(&base,p,sec,pc))
+    goto done;
+#endif
+  if(p->type==SYM){
+    if(p->c.sym->type==EXPRESSION){
+      if(evn[n].left<0){
+        /* value came from the cache, the equate was not evaluated */
+        l=ev_node(p->c.sym->expr);
+        evn[n].left=l;
+      }
+      l=evn[n].left;
+      ret=ev_base(l,sec,pc);
+      if(evn[l].bset)
+        base=evn[l].base;
+    }
+    else{
+      if(evn[n].cnst<0){
+        /* references were not recorded by evaluation */
+        update_curpc(p,sec,pc);
+        if(record_symref&&LOCREF(p->c.sym))
+          record_symref(p->c.sym==cpc?NULL:p->c.sym);
+      }
+      base=p->c.sym;  /* set base to symbol, also when BASE_ILLEGAL later */
+      ret=BASE_OK;
+    }
+  }
+  else if(p->type==ADD){
+    l=ev_left(n);
+    r=ev_right(n);
+    if(evn[ev_eval(l,sec,pc)].cnst){
+      ret=ev_base(r,sec,pc);
+      if(evn[r].bset)
+        base=evn[r].base;
+    }
+    if(ret!=BASE_OK){
+      ret=BASE_ILLEGAL;
+      if(evn[ev_eval(r,sec,pc)].cnst){
+        if(ev_base(l,sec,pc)==BASE_OK)
+          ret=BASE_OK;
+        if(evn[l].bset)
+          base=evn[l].base;
+      }
+    }
+  }
+  else if(p->type==SUB){
+    l=ev_left(n);
+    r=ev_right(n);
+    if(evn[ev_eval(r,sec,pc)].cnst&&ev_base(l,sec,pc)==BASE_OK)
+      ret=BASE_OK;
+    else if(ev_base(l,sec,pc)==BASE_OK&&ev_base(r,sec,pc)==BASE_OK){
+      pcsym=evn[r].base;
+      if(pcsym&&LOCREF(pcsym)&&pcsym->sec==sec&&evn[l].base&&
+         (LOCREF(evn[l].base)||EXTREF(evn[l].base)))
+        ret=BASE_PCREL;
+    }
+    if(evn[l].bset)
+      base=evn[l].base;
+  }
+#ifdef EXT_FIND_BASE
+done:
+#endif
+  evn[n].btype=ret;
+  evn[n].bset=base!=&nobase;
+  evn[n].base=evn[n].bset?base:NULL;
+  return ret;
+}
+
+static int ec_count(expr *tree)
+{
+  return tree ? 1+ec_count(tree->left)+ec_count(tree->right) : 0;
+}
+
+static int ec_fill(struct exprcode *code,expr *tree)
+{
+  int l=tree->left?ec_fill(code,tree->left):-1;
+  int r=tree->right?ec_fill(code,tree->right):-1;
+
+  code->node[code->n].tree=tree;
+  code->node[code->n].left=l;
+  code->node[code->n].right=r;
+  return code->n++;
+}
+
+/* returns the link to the compiled form of a tree, which may be NULL */
+static struct exprcode **ec_find(expr *tree)
+{
+  struct exprcode **pp=&ectab[((size_t)tree/sizeof(expr))&(ecsize-1)];
+
+  while(*pp&&ECROOT(*pp)!=tree)
+    pp=&(*pp)->next;
+  return pp;
+}
+
+static void ec_grow(void)
+{
+  struct exprcode **old=ectab,*code,*next;
+  size_t oldsize=ecsize,i;
+
+  ecsize=ecsize?ecsize*2:ECTABSIZE;
+  ectab=mycalloc(ecsize*sizeof(*ectab));
+  for(i=0;i<oldsize;i++){
+    for(code=old[i];code;code=next){
+      next=code->next;
+      code->next=NULL;
+      *ec_find(ECROOT(code))=code;
+    }
+  }
+  myfree(old);
+}
+
+static struct exprcode *compile_expr(expr *tree)
+{
+  struct exprcode *code=mymalloc(sizeof(struct exprcode)+
+                                 (ec_count(tree)-1)*sizeof(struct ecnode));
+
+  code->next=NULL;
+  code->n=0;
+  ec_fill(code,tree);
+  if(ecused>=ecsize)
+    ec_grow();
+  *ec_find(tree)=code;  /* appended to the chain */
+  ecused++;
+  return code;
+}
+
+/* forget the compiled form of a tree, which is freed or changes shape */
+static void uncompile_expr(expr *tree)
+{
+  struct exprcode **pp,*code;
+
+  if(ecused&&(code=*(pp=ec_find(tree)))!=NULL){
+    *pp=code->next;
+    myfree(code);
+    ecused--;
+  }
+}
+
+/* evaluate a compiled expression, returns the evnode of its root */
+static int ec_eval(struct exprcode *code,section *sec,taddr pc)
+{
+  struct ecnode *p;
+  int first,i;
+
+  ev_reserve(code->n);
+  first=evtop;
+  for(i=0,p=code->node;i<code->n;i++,p++){
+    evn[first+i].tree=p->tree;
+    evn[first+i].cnst=-1;
+    evn[first+i].btype=BASE_UNKNOWN;
+    evn[first+i].left=p->left<0?-1:first+p->left;
+    evn[first+i].right=p->right<0?-1:first+p->right;
+  }
+  evtop+=code->n;
+  for(i=0;i<code->n;i++)
+    ev_op(first+i,sec,pc);
+  return first+code->n-1;
+}
+
+/* evaluate a tree, using its compiled form when enabled */
+static int ev_root(expr *tree,section *sec,taddr pc)
+{
+  if(compile_exprs&&tree&&(tree->left||tree->right)){
+    struct exprcode *code=ecused?*ec_find(tree):NULL;
+
+    if(code==NULL&&!error_trap)  /* workers don't compile shared trees */
+      code=compile_expr(tree);
+    if(code)
+      return ec_eval(code,sec,pc);
+  }
+  return ev_eval(ev_node(tree),sec,pc);
+}
+
+/* -exprcheck: evaluate the tree again and compare with compiled node n */
+static int ev_check(expr *tree,int n,section *sec,taddr pc)
+{
+  int t;
+
+  if(compile_exprs<2||!tree||!ecused||*ec_find(tree)==NULL)
+    return -1;
+  t=ev_eval(ev_node(tree),sec,pc);
+  if(evn[t].val!=evn[n].val||evn[t].cnst!=evn[n].cnst)
+    general_error(91);  /* compiled expression evaluation differs */
+  return t;
+}
+
+/* Reset the evaluator of a worker thread, after an evaluation was aborted
+   by error_trap. With release, its memory is freed as well. */
+void reset_eval(int release)
+{
+  evtop=0;
+  eval_depth=0;
+  if(release){
+    myfree(evn);
+    evn=NULL;
+    evmax=0;
+  }
+}
+
+/* Evaluate an expression using current values of all symbols.
+   Result is written to *result. The return value specifies
+   whether the result is constant (i.e. only depending on
+   constants or absolute symbols). */
+int eval_expr(expr *tree,taddr *result,section *sec,taddr pc)
+{
+  int top=evtop;
+  int n=ev_root(tree,sec,pc);
+  int cnst=evn[n].cnst;
+
+  ev_check(tree,n,sec,pc);
+  *result=evn[n].val;
+  evtop=top;
+  return cnst;
+}
+
+/* Same as eval_expr(), but when the result is not constant, the base
+   symbol is determined in the same pass, as find_base() would do it.
+   *btype is set to BASE_NONE for a constant result. */
+int eval_expr_base(expr *tree,taddr *result,symbol **base,int *btype,
+                   section *sec,taddr pc)
+{
+  int top=evtop;
+  int n=ev_root(tree,sec,pc);
+  int cnst=evn[n].cnst;
+  int t=ev_check(tree,n,sec,pc);
+
+  *result=evn[n].val;
+  if(cnst){
+    *base=NULL;
+    *btype=BASE_NONE;
+  }
+  else{
+    *btype=ev_base(n,sec,pc);
+    *base=evn[n].base;
+    if(t>=0&&(ev_base(t,sec,pc)!=*btype||evn[t].base!=*base))
+      general_error(91);  /* compiled expression evaluation differs */
+  }
+  evtop=top;
   return cnst;
 }
 
@@ -1242,11 +1770,9 @@ int eval_expr_huge(expr *tree,thuge *result)
   case SYM:
     if(tree->c.sym->type==EXPRESSION){
       int ok;
-      if(tree->c.sym->flags&INEVAL)
-        general_error(18,tree->c.sym->name);
-      tree->c.sym->flags|=INEVAL;
+      enter_sym(tree->c.sym);
       ok=eval_expr_huge(tree->c.sym->expr,&val);
-      tree->c.sym->flags&=~INEVAL;
+      leave_sym(tree->c.sym);
       if(!ok) return 0;
     }
 #if 0 /* all relocations should be representable by taddr */
@@ -1331,11 +1857,9 @@ int eval_expr_float(expr *tree,tfloat *result)
   case SYM:
     if(tree->c.sym->type==EXPRESSION){
       int ok;
-      if(tree->c.sym->flags&INEVAL)
-        general_error(18,tree->c.sym->name);
-      tree->c.sym->flags|=INEVAL;
+      enter_sym(tree->c.sym);
       ok=eval_expr_float(tree->c.sym->expr,&val);
-      tree->c.sym->flags&=~INEVAL;
+      leave_sym(tree->c.sym);
       if(!ok) return 0;
     }else
       return 0;
@@ -1375,55 +1899,19 @@ void print_expr(FILE *f,expr *p)
     fprintf(f,"complex expression");
 }
 
-static int _find_base(expr *p,symbol **base,section *sec,taddr pc)
-{
-#ifdef EXT_FIND_BASE
-  int ret;
-  if(ret=EXT_FIND_BASE(base,p,sec,pc))
-    return ret;
-#endif
-  if(p->type==SYM){
-    update_curpc(p,sec,pc);
-    if(p->c.sym->type==EXPRESSION)
-      return _find_base(p->c.sym->expr,base,sec,pc);
-    else{
-      if(base)
-        *base=p->c.sym;  /* set base to symbol, also when BASE_ILLEGAL later */
-      return BASE_OK;
-    }
-  }
-  if(p->type==ADD){
-    taddr val;
-    if(eval_expr(p->left,&val,sec,pc)&&
-       _find_base(p->right,base,sec,pc)==BASE_OK)
-      return BASE_OK;
-    if(eval_expr(p->right,&val,sec,pc)&&
-       _find_base(p->left,base,sec,pc)==BASE_OK)
-      return BASE_OK;
-  }
-  if(p->type==SUB){
-    taddr val;
-    symbol *pcsym;
-    if(eval_expr(p->right,&val,sec,pc)&&
-       _find_base(p->left,base,sec,pc)==BASE_OK)
-      return BASE_OK;
-    if(_find_base(p->left,base,sec,pc)==BASE_OK&&
-       _find_base(p->right,&pcsym,sec,pc)==BASE_OK) {
-      if(LOCREF(pcsym)&&pcsym->sec==sec&&(LOCREF(*base)||EXTREF(*base)))
-        return BASE_PCREL;
-    }
-  }
-  return BASE_ILLEGAL;
-}
-
 /* Tests, if an expression is based only on one non-absolute
    symbol plus constants. Returns that symbol or zero.
    Note: Does not find all possible solutions. */
 int find_base(expr *p,symbol **base,section *sec,taddr pc)
 {
+  int top=evtop;
+  int n=ev_node(p);
+  int btype=ev_base(n,sec,pc);
+
   if(base)
-    *base=NULL;
-  return _find_base(p,base,sec,pc);
+    *base=evn[n].base;
+  evtop=top;
+  return btype;
 }
 
 expr *number_expr(taddr val)
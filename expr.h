@@ -37,11 +37,15 @@ struct expr {
 /* global variables */
 extern char current_pc_char;
 extern int unsigned_shift;
+extern THREADLOCAL void (*record_symref)(symbol *);
+extern unsigned long symval_epoch;
+extern int compile_exprs;
 
 /* functions */
 expr *new_expr(void);
 expr *make_expr(int,expr *,expr *);
 expr *copy_tree(expr *);
+int same_expr(expr *,expr *);
 expr *new_sym_expr(symbol *);
 expr *curpc_expr(void);
 expr *parse_expr(char **);
@@ -55,7 +59,10 @@ void free_expr(expr *);
 int type_of_expr(expr *);
 expr **find_sym_expr(expr **,char *);
 void simplify_expr(expr *);
+void fold_equates(void);
+void reset_eval(int);
 int eval_expr(expr *,taddr *,section *,taddr);
+int eval_expr_base(expr *,taddr *,symbol **,int *,section *,taddr);
 int eval_expr_huge(expr *,thuge *);
 void print_expr(FILE *,expr *);
 int find_base(expr *,symbol **,section *,taddr);
@@ -88,4 +88,7 @@
   "additional macro arguments ignored (expecting %d)",WARNING,
   "string symbol <%s> redefined",ERROR,
   "symbol <%s> cannot be redefined as a string symbol",ERROR,
-  "internal symbol <%s> not found",ERROR,						/* 90 */
\ No newline at end of file
+  "internal symbol <%s> not found",ERROR,						/* 90 */
+  "compiled expression evaluation differs",ERROR,
+  "batch mode is not supported on this host",NOLINE|ERROR|FATAL,
+  "missing output file in line %d of batch file <%s>",NOLINE|ERROR,
\ No newline at end of file
@@ -15,6 +15,7 @@ int produce_listing,listena,listnosyms;
 int listformfeed=1,listlinesperpage=40;
 listing *first_listing,*last_listing,*cur_listing;
 
+static mempool listing_pool = MEMPOOL("listings",sizeof(listing));
 static int listbpl=8;
 static int listnoinc,listformat,listtitlecnt,listall,listlabelsonly;
 static char **listtitles;
@@ -65,7 +66,7 @@ int listing_option(char *arg)
 
 listing *new_listing(source *src,int line)
 {
-  listing *new = mymalloc(sizeof(*new));
+  listing *new = pool_alloc(&listing_pool);
 
   new->next = NULL;
   new->line = line;
@@ -302,7 +303,7 @@ static void write_listing_old(char *listname,section *first_section)
   fclose(f);
   for(p=first_listing;p;){
     listing *m=p->next;
-    myfree(p);
+    pool_free(&listing_pool,p);
     p=m;
   }
 }
@@ -379,7 +380,7 @@ static void write_listing_old(char *listname,section *first_section)
   fclose(f);
   for(p=first_listing;p;){
     listing *m=p->next;
-    myfree(p);
+    pool_free(&listing_pool,p);
     p=m;
   }
 }
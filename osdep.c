@@ -1,15 +1,28 @@
 /* osdep.c - OS-dependant routines */
 /* (c) in 2018,2020 by Frank Wille */
 
+#if defined(UNIX)
+#define _POSIX_C_SOURCE 200112L  /* for fileno() and mmap() */
+#endif
+#include <stdio.h>
 #include <string.h>
 char *mystrdup(const char *);
 void *mymalloc(size_t);
+void myfree(void *);
 struct symbol *internal_abs(char *);
 
 #define MAX_WORKDIR_LEN 1024
 
 #if defined(UNIX)
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#ifdef VASM_THREADS
+#include <pthread.h>
+#endif
 
 #elif defined(AMIGA)
 #include <dos/dos.h>
@@ -203,6 +216,182 @@ char *get_workdir(void)
 }
 #endif
 
+#if defined(UNIX)
+char *map_file(FILE *f,size_t *size,size_t pad)
+/* Map a whole regular file into memory, copy-on-write. At least 'pad'
+   writable bytes must follow the file's contents in its last page.
+   Returns NULL, when the file cannot be mapped, so pipes and devices
+   are read as usual. Note that the process gets a SIGBUS, when another
+   process truncates the file while it is mapped. */
+{
+  struct stat st;
+  long pgsize = sysconf(_SC_PAGESIZE);
+  size_t fsize,psize;
+  void *p;
+
+  if (fstat(fileno(f),&st)<0 || !S_ISREG(st.st_mode) || st.st_size<=0 ||
+      pgsize<=0)
+    return NULL;
+  fsize = (size_t)st.st_size;
+  psize = (size_t)pgsize;
+  if ((off_t)fsize != st.st_size)
+    return NULL;  /* too large for the address space */
+  if (pad && (psize - fsize%psize) % psize < pad)
+    return NULL;  /* no room for the pad bytes in the last page */
+  p = mmap(NULL,fsize+pad,PROT_READ|PROT_WRITE,MAP_PRIVATE,fileno(f),0);
+  if (p == MAP_FAILED)
+    return NULL;
+  *size = fsize;
+  return p;
+}
+
+#else  /* portable default */
+char *map_file(FILE *f,size_t *size,size_t pad)
+{
+  return NULL;
+}
+#endif
+
+#if defined(UNIX)
+int file_stamp(const char *name,unsigned long *size,unsigned long *chtime)
+/* Get size and status change time of a file, to find out whether a copy
+   in memory is still up to date. The change time is also updated when
+   the modification time has been reset. Returns 0 when unknown. */
+{
+  struct stat st;
+
+  if (stat(name,&st) != 0)
+    return 0;
+  *size = (unsigned long)st.st_size;
+  *chtime = (unsigned long)st.st_ctime;
+  return 1;
+}
+
+#else  /* portable default */
+int file_stamp(const char *name,unsigned long *size,unsigned long *chtime)
+{
+  return 0;
+}
+#endif
+
+#if defined(UNIX)
+int fork_job(FILE *out)
+/* Start a copy of the current process for an assembly job. Returns 0
+   in the copy, a positive number in the caller and -1 on failure.
+   The copy reads from /dev/null, so it never moves the caller's input
+   position when it exits. With out != NULL the copy's standard output
+   and standard error go to that file. */
+{
+  int pid,fd;
+
+  fflush(stdout);
+  fflush(stderr);
+  if ((pid = (int)fork()) == 0) {
+    if ((fd = open("/dev/null",O_RDONLY)) >= 0) {
+      dup2(fd,STDIN_FILENO);
+      close(fd);
+    }
+    if (out != NULL) {
+      dup2(fileno(out),STDOUT_FILENO);
+      dup2(fileno(out),STDERR_FILENO);
+    }
+  }
+  return pid;
+}
+
+int wait_job(void)
+/* Wait until one of the jobs started by fork_job() has finished.
+   Returns 0 when it succeeded, 1 when it failed and -1 when there
+   are no more jobs. */
+{
+  int status;
+
+  if (wait(&status) < 0)
+    return -1;
+  return !(WIFEXITED(status) && WEXITSTATUS(status)==0);
+}
+
+#else  /* portable default */
+int fork_job(FILE *out)
+{
+  return -1;
+}
+
+int wait_job(void)
+{
+  return -1;
+}
+#endif
+
+int threads_running;  /* number of threads started by run_threads() */
+
+#if defined(UNIX) && defined(VASM_THREADS)
+static pthread_mutex_t thread_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+struct thread_arg {
+  pthread_t id;
+  void (*fn)(int);
+  int n;
+};
+
+static void *thread_main(void *arg)
+{
+  struct thread_arg *t = arg;
+
+  t->fn(t->n);
+  return NULL;
+}
+
+int run_threads(int n,void (*fn)(int))
+/* Call fn(1) to fn(n-1) in new threads and fn(0) in the current one,
+   then wait for all of them. Returns the number of threads which ran
+   fn(), or 0 when no thread could be created and fn() was not called. */
+{
+  struct thread_arg *t = mymalloc(n * sizeof(struct thread_arg));
+  int i,started;
+
+  threads_running = n;
+  for (i=1; i<n; i++) {
+    t[i].fn = fn;
+    t[i].n = i;
+    if (pthread_create(&t[i].id,NULL,thread_main,&t[i]) != 0)
+      break;
+  }
+  started = i;
+  if (started > 1)
+    fn(0);
+  for (i=1; i<started; i++)
+    pthread_join(t[i].id,NULL);
+  threads_running = 0;
+  myfree(t);
+  return started>1 ? started : 0;
+}
+
+void lock_threads(void)
+{
+  pthread_mutex_lock(&thread_mutex);
+}
+
+void unlock_threads(void)
+{
+  pthread_mutex_unlock(&thread_mutex);
+}
+
+#else  /* portable default */
+int run_threads(int n,void (*fn)(int))
+{
+  return 0;
+}
+
+void lock_threads(void)
+{
+}
+
+void unlock_threads(void)
+{
+}
+#endif
+
 int init_osdep(void)
 {
 #if defined(UNIX)
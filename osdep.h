@@ -7,9 +7,18 @@
 #define filenamecmp(a,b) strcmp(a,b)
 #endif
 
+extern int threads_running;
+
 char *convert_path(const char *);
 char *append_path_delimiter(const char *);
 char *remove_path_delimiter(const char *);
 char *get_filepart(char *);
 char *get_workdir(void);
+char *map_file(FILE *,size_t *,size_t);
+int file_stamp(const char *,unsigned long *,unsigned long *);
+int fork_job(FILE *);
+int wait_job(void);
+int run_threads(int,void (*)(int));
+void lock_threads(void);
+void unlock_threads(void);
 int init_osdep(void);
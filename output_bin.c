@@ -200,8 +200,13 @@ static void write_output(FILE *f,section *sec,symbol *sym)
 
       default:
         /* fill gap between sections with pad-bytes */
-        if (s!=seclist[0] && ((unsigned long long)s->org) > pc)
-          fwalignpattern(f,((unsigned long long)s->org)-pc,s->pad,s->padbytes);
+        if (s!=seclist[0] && ((unsigned long long)s->org) > pc) {
+          if (zero_pattern(s->pad,s->padbytes))
+            fwzeros(f,((unsigned long long)s->org)-pc);
+          else
+            fwalignpattern(f,((unsigned long long)s->org)-pc,
+                           s->pad,s->padbytes);
+        }
         break;
     }
 
@@ -211,8 +216,15 @@ static void write_output(FILE *f,section *sec,symbol *sym)
 
       if (p->type == DATA)
         fwdata(f,p->content.db->data,p->content.db->size);
-      else if (p->type == SPACE)
-        fwsblock(f,p->content.sb);
+      else if (p->type == SPACE) {
+        sblock *sb = p->content.sb;
+
+        /* large zero-filled space is skipped, leaving a hole in the file */
+        if (zero_pattern(sb->fill,sb->size))
+          fwzeros(f,sb->space*sb->size);
+        else
+          fwsblock(f,sb);
+      }
 
       pc = npc + atom_size(p,s,npc);
     }
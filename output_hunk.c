@@ -1063,6 +1063,7 @@ static int common_args(char *p)
 #endif
   if (!strcmp(p,"-linedebug")) {
     genlinedebug = 1;
+    no_coalesce = 1;  /* we need the source line of each data atom */
     return 1;
   }
   if (!strcmp(p,"-keepempty")) {
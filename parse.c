@@ -8,6 +8,7 @@ int nocase_macros;      /* macro names are case-insensitive */
 int maxmacparams = MAXMACPARAMS;
 int maxmacrecurs = MAXMACRECURS;
 int msource_disable;    /* true: disable source level debugging within macro */
+unsigned long num_macro_calls;
 
 #ifndef MACROHTABSIZE
 #define MACROHTABSIZE 0x800
@@ -34,6 +35,14 @@ static char *rept_start,*rept_name,*rept_vals;
 static section *cur_struct;
 static section *struct_prevsect;
 
+#ifndef MACRO_SPECIAL
+/* macro arguments and the unique id start with a backslash */
+#define MACRO_SPECIAL(c) ((c)=='\\')
+#endif
+
+/* characters which end a run of literal source text */
+static unsigned char literal_end[256];
+
 char *escape(char *s,char *code)
 {
   char dummy;
@@ -501,6 +510,18 @@ int find_macarg_name(source *src,char *name,size_t len)
 
   /* named macro arguments */
   if (src->macro != NULL) {
+    macro *m = src->macro;
+
+    if (src->curmark<m->nmarks && src->text==m->text) {
+      /* argument name behind the current backslash was resolved before */
+      char *p = src->text + m->marks[src->curmark];
+
+      if (*p=='\\' && (name==p+1 || (name==p+2 && *(p+1)=='?'))) {
+        if ((idx = m->markarg[src->curmark]) >= 0)
+          return idx;
+        goto irpname;
+      }
+    }
     for (idx=0,ma=src->argnames; ma!=NULL && idx<maxmacparams;
          idx++,ma=ma->argnext) {
       /* @@@ case-sensitive comparison? */
@@ -510,6 +531,7 @@ int find_macarg_name(source *src,char *name,size_t len)
   }
 
   /* repeat-loop iterator name */
+irpname:
   if (src->irpname != NULL) {
     if (strlen(src->irpname)==len && strncmp(src->irpname,name,len)==0) {
       /* copy current iterator value to param[MAXMACPARAMS] */
@@ -647,12 +669,14 @@ macro *find_macro(char *name,int name_len)
 
   if (nocase_macros) {
     if (!find_namelen_nc(macrohash,name,name_len,&data))
-      return NULL;
+      data.ptr = NULL;
   }
   else {
     if (!find_namelen(macrohash,name,name_len,&data))
-      return NULL;
+      data.ptr = NULL;
   }
+  if (inccache_recording)
+    inccache_macprobe(name,name_len,data.ptr);
   return data.ptr;
 }
 
@@ -683,6 +707,8 @@ int execute_macro(char *name,int name_len,char **q,int *q_len,int nq,
 
   if ((m = find_macro(name,name_len)) == NULL)
     return 0;
+  if (inccache_recording)
+    inccache_taint();
 
   /* it's a macro: read arguments and execute it */
   if (m->recursions >= maxmacrecurs) {
@@ -690,6 +716,7 @@ int execute_macro(char *name,int name_len,char **q,int *q_len,int nq,
     return 0;
   }
   m->recursions++;
+  num_macro_calls++;
 
   src = new_source(m->name,NULL,m->text,m->size);
   src->macro = m;
@@ -816,6 +843,8 @@ int leave_macro(void)
 /* remove an already defined macro from the hash table */
 int undef_macro(char *name)
 {
+  if (inccache_recording)
+    inccache_taint();
   if (find_macro(name,strlen(name))) {
     rem_hashentry(macrohash,name,nocase_macros);
     return 1;
@@ -825,6 +854,132 @@ int undef_macro(char *name)
 }
 
 
+#ifdef COPY_OPERAND
+/* A repeat-block is invariant, when its second iteration creates the same
+   atoms as the first one, without defining or changing any symbol and
+   without any message. It must neither contain conditional directives
+   nor read the repetition counter, which both may change the following
+   iterations. Then the remaining iterations are not parsed, but copied
+   from the second one. */
+struct reptcheck {
+  section *sec;
+  atom *first;           /* last atom before the first iteration */
+  atom *second;          /* last atom of the first iteration */
+  unsigned long atoms;   /* atoms_added at start of current iteration */
+  unsigned long count;   /* atoms created by the first iteration */
+  unsigned long syms;    /* symbol_changes at start of current iteration */
+  unsigned long errs;    /* error_calls before the first iteration */
+  unsigned long conds;   /* cond_calls before the first iteration */
+#ifdef REPTNSYM
+  symbol *reptn;
+  uint32_t reptnused;    /* USED flag of REPTN before the repetition */
+#endif
+};
+
+static void start_reptcheck(source *src)
+{
+  struct reptcheck *rc;
+
+  if (src->irpname!=NULL || src->repeat<3 || produce_listing ||
+      current_section==NULL)
+    return;
+  rc = mymalloc(sizeof(struct reptcheck));
+  rc->sec = current_section;
+  rc->first = current_section->last;
+  rc->second = NULL;
+  rc->atoms = atoms_added;
+  rc->syms = symbol_changes;
+  rc->errs = error_calls;
+  rc->conds = cond_calls;
+#ifdef REPTNSYM
+  /* expressions set USED, when they read the repetition counter */
+  if ((rc->reptn = find_symbol(REPTNSYM)) == NULL)
+    ierror(0);
+  rc->reptnused = rc->reptn->flags & USED;
+  rc->reptn->flags &= ~USED;
+#endif
+  src->reptchk = rc;
+}
+
+static void end_reptcheck(source *src)
+{
+  struct reptcheck *rc = src->reptchk;
+
+#ifdef REPTNSYM
+  rc->reptn->flags |= rc->reptnused;
+#endif
+  myfree(rc);
+  src->reptchk = NULL;
+}
+
+/* count atoms following a, up to the section's last atom */
+static unsigned long atoms_after(section *sec,atom *a)
+{
+  unsigned long n = 0;
+
+  for (a=a?a->next:sec->first; a!=NULL; a=a->next)
+    n++;
+  return n;
+}
+
+/* Called at the end of an iteration. Returns true when the remaining
+   iterations have been replaced by copies. */
+static int check_repeat(source *src)
+{
+  struct reptcheck *rc = src->reptchk;
+  section *sec = rc->sec;
+  atom *a,*b,*last;
+  unsigned long n,i;
+
+  if (src->repeat>=2 && sec==current_section && rc->errs==error_calls &&
+#ifdef REPTNSYM
+      !(rc->reptn->flags & USED) &&
+#endif
+      rc->conds==cond_calls) {
+    n = atoms_added - rc->atoms;
+
+    if (rc->second == NULL) {
+      /* end of first iteration: all atoms have to be in this section */
+      if (n>0 && atoms_after(sec,rc->first)==n) {
+        rc->second = sec->last;
+        rc->atoms = atoms_added;
+        rc->count = n;
+        return 0;
+      }
+    }
+    else if (n==rc->count && rc->syms==symbol_changes &&
+             atoms_after(sec,rc->second)==n) {
+      /* end of second iteration: compare with the first one */
+      a = rc->first ? rc->first->next : sec->first;
+      for (b=rc->second->next; b!=NULL; a=a->next,b=b->next) {
+        if (!same_atom(a,b))
+          break;
+      }
+      if (b == NULL) {
+        /* invariant: copy the second iteration for the remaining ones */
+        last = sec->last;
+        for (i=src->repeat-1; i>0; i--) {
+          b = rc->second;
+          do {
+            b = b->next;
+            a = copy_atom(b);
+            add_atom(sec,a);
+            a->src = b->src;  /* messages refer to the original line */
+            a->line = b->line;
+          }
+          while (b != last);
+        }
+        end_reptcheck(src);
+        return 1;
+      }
+    }
+  }
+  end_reptcheck(src);
+  return 0;
+}
+#endif /* COPY_OPERAND */
+
+
 static void start_repeat(char *rept_end)
 {
   char buf[MAXPATHLEN];
@@ -832,6 +987,8 @@ static void start_repeat(char *rept_end)
   char *p;
   int i;
 
+  if (inccache_recording)
+    inccache_taint();
   reptdir_list = NULL;
   if ((rept_cnt<0 && rept_cnt!=REPT_IRP && rept_cnt!=REPT_IRPC) ||
       cur_src==NULL || strlen(cur_src->name) + 24 >= MAXPATHLEN)
@@ -916,22 +1073,121 @@ static void start_repeat(char *rept_end)
 
     if (src->repeat == 0)
       ierror(0);
+#ifdef COPY_OPERAND
+    start_reptcheck(src);
+#endif
     cur_src = src;  /* repeat it */
   }
 }
 
 
+/* Split a macro body into spans of literal characters, which are copied
+   at once by read_next_line(). Each span ends with a character which may
+   start an expansion, or ends the line. Named arguments following a
+   backslash are looked up here, once for all invocations. */
+static void compile_macro(macro *m)
+{
+  char *p,*q,*e,*end = m->text + m->size;
+  struct macarg *ma;
+  int i,n;
+
+  for (n=0,p=m->text; p<end; p++) {
+    if (literal_end[(unsigned char)*p])
+      n++;
+  }
+  m->marks = n ? mymalloc(n*sizeof(size_t)) : NULL;
+  m->markarg = n ? mymalloc(n*sizeof(int)) : NULL;
+
+  for (i=0,p=m->text; p<end; p++) {
+    if (literal_end[(unsigned char)*p]) {
+      m->marks[i] = p - m->text;
+      m->markarg[i] = -1;
+      if (*p == '\\') {
+        q = *(p+1)=='?' ? p+2 : p+1;
+        if (ISIDSTART(*q) && (e = skip_identifier(q)) != NULL) {
+          for (n=0,ma=m->argnames; ma!=NULL && n<maxmacparams;
+               n++,ma=ma->argnext) {
+            if (ma->arglen==(size_t)(e-q) && strncmp(ma->argname,q,e-q)==0) {
+              m->markarg[i] = n;
+              break;
+            }
+          }
+        }
+      }
+      i++;
+    }
+  }
+  m->nmarks = i;
+}
+
+
+/* copy literal characters of a compiled macro body up to the next
+   span end, return -1 when the line buffer is full */
+static int copy_span(source *src,char **line,char *d,int dlen)
+{
+  macro *m = src->macro;
+  size_t offs = *line - src->text;
+  char *end;
+  int n;
+
+  while (src->curmark<m->nmarks && m->marks[src->curmark]<offs)
+    src->curmark++;
+  end = src->curmark<m->nmarks ? src->text+m->marks[src->curmark] :
+                                 src->text+src->size;
+  if ((n = end - *line) <= 0)
+    return 0;
+  if (dlen <= 0)
+    return -1;
+  if (n > dlen)
+    n = dlen;
+  memcpy(d,*line,n);
+  *line += n;
+  return n;
+}
+
+
+/* copy a run of source characters which can neither start an expansion
+   nor end the line, return -1 when the line buffer is full */
+static int copy_literal(char **line,char *end,char *d,int dlen)
+{
+  char *s = *line;
+  int n;
+
+  while (s<end && !literal_end[(unsigned char)*s])
+    s++;
+  if ((n = s - *line) == 0)
+    return 0;
+  if (dlen <= 0)
+    return -1;
+  if (n > dlen)
+    n = dlen;
+  memcpy(d,*line,n);
+  *line += n;
+  return n;
+}
+
+
+/* enter a completely defined macro */
+void define_macro(macro *m)
+{
+  hashdata data;
+
+  compile_macro(m);
+  m->next = first_macro;
+  first_macro = m;
+  data.ptr = m;
+  add_hashentry(macrohash,m->name,data);
+}
+
+
 static void add_macro(void)
 {
   if (cur_macro!=NULL && cur_src!=NULL) {
     if (cur_macro->text != NULL) {
-      hashdata data;
-
       cur_macro->size = cur_src->srcptr - cur_macro->text;
-      cur_macro->next = first_macro;
-      first_macro = cur_macro;
-      data.ptr = cur_macro;
-      add_hashentry(macrohash,cur_macro->name,data);
+      define_macro(cur_macro);
+      if (inccache_recording)
+        inccache_macro(cur_macro);
     }
     cur_macro = NULL;
   }
@@ -1024,7 +1280,7 @@ section *find_structure(char *name,int name_len)
 char *read_next_line(void)
 {
   char *s,*srcend,*d;
-  int nparam,len;
+  int nparam,len,spans;
   int skip_listing = 0;
   char *rept_end = NULL;
 
@@ -1032,6 +1288,10 @@ char *read_next_line(void)
   for (;;) {
     srcend = cur_src->text + cur_src->size;
     if (cur_src->srcptr >= srcend || *(cur_src->srcptr) == '\0') {
+#ifdef COPY_OPERAND
+      if (cur_src->reptchk!=NULL && check_repeat(cur_src))
+        cur_src->repeat = 1;  /* remaining iterations have been copied */
+#endif
       if (--cur_src->repeat > 0) {
         struct macarg *irpval;
 
@@ -1044,6 +1304,10 @@ char *read_next_line(void)
         }
 #ifdef REPTNSYM
         set_internal_abs(REPTNSYM,++cur_src->reptn);
+#endif
+#ifdef COPY_OPERAND
+        if (cur_src->reptchk != NULL)
+          cur_src->reptchk->syms = symbol_changes;
 #endif
       }
       else {
@@ -1053,6 +1317,8 @@ char *read_next_line(void)
         }
         myfree(cur_src->linebuf);  /* linebuf is no longer needed, saves memory */
         cur_src->linebuf = NULL;
+        if (inccache_recording)
+          inccache_end(cur_src);
         if (cur_src->parent == NULL)
           return NULL;  /* no parent source means end of assembly! */
         cur_src = cur_src->parent;  /* return to parent source */
@@ -1165,10 +1431,16 @@ char *read_next_line(void)
     nparam = 0;  /* expand current repeat-iterator symbol into source */
 
   /* copy next line to linebuf */
+  spans = cur_src->macro!=NULL && cur_src->macro->nmarks>=0 &&
+          cur_src->text==cur_src->macro->text;
   while (s<srcend && *s!='\0') {
     int nc;
 
-    if (nparam >= 0)
+    if (spans && (nc = copy_span(cur_src,&s,d,len)) != 0)
+      ;  /* copied literal characters of a compiled macro */
+    else if (!spans && (nc = copy_literal(&s,srcend,d,len)) != 0)
+      ;  /* copied literal characters up to the next candidate */
+    else if (nparam >= 0)
       nc = expand_macro(cur_src,&s,d,len);  /* try macro arg. expansion */
     else
       nc = 0;
@@ -1240,7 +1512,13 @@ char *read_next_line(void)
 
 int init_parse(void)
 {
+  int c;
+
+  for (c=0; c<256; c++)
+    literal_end[c] = MACRO_SPECIAL(c) || c=='\n' || c=='\r' || c=='\0';
   macrohash = new_hashtable(MACROHTABSIZE);
+  name_hashtable(macrohash,"macros");
   structhash = new_hashtable(STRUCTHTABSIZE);
+  name_hashtable(structhash,"structs");
   return 1;
 }
@@ -34,6 +34,9 @@ struct macro {
   struct macarg *defaults;
   int vararg;
   int recursions;
+  int nmarks;                   /* number of span ends in marks */
+  size_t *marks;                /* offsets of characters ending a span */
+  int *markarg;                 /* named argument following a backslash */
 };
 
 struct namelen {
@@ -45,6 +48,7 @@ struct namelen {
 extern int esc_sequences,nocase_macros;
 extern int maxmacparams,maxmacrecurs;
 extern int msource_disable;
+extern unsigned long num_macro_calls;
 
 /* functions */
 char *escape(char *,char *);
@@ -66,6 +70,7 @@ int find_macarg_name(source *,char *,size_t);
 struct macarg *addmacarg(struct macarg **,char *,char *);
 macro *new_macro(char *,struct namelen *,struct namelen *,char *);
 macro *find_macro(char *,int);
+void define_macro(macro *);
 int execute_macro(char *,int,char **,int *,int,char *);
 int leave_macro(void);
 int undef_macro(char *);
@@ -27,7 +27,11 @@ rlist *add_extnreloc(rlist **relocs,symbol *sym,taddr addend,int type,
     return NULL;  /* no relocation, when symbol is from an ORG-section */
 
   /* mark symbol as referenced, so we can find unreferenced imported symbols */
-  sym->flags |= REFERENCED;
+  if (!(sym->flags & REFERENCED)) {
+    if (error_trap)
+      longjmp(*error_trap,1);  /* leave the flag to the serial pass */
+    sym->flags |= REFERENCED;
+  }
 
   r = new_nreloc();
   r->byteoffset = byteoffs;
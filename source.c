@@ -9,11 +9,20 @@
 
 char *compile_dir;
 int ignore_multinc,nocompdir,depend,depend_all;
+char *inccache_dir;
+int inccache_recording;
+clock_t srcread_time;  /* accumulated with -profile */
 
 static struct include_path *first_incpath;
-static struct source_file *first_source;
+static struct source_file *first_source,*last_source;
 static struct deplist *first_depend,*last_depend;
 
+/* Source files and include path search results, indexed by file name.
+   Hash keys are folded to lower case, so they are found independently of
+   -nocase. Names which only differ in case are chained and compared by
+   filenamecmp(). */
+static hashtable *srchash,*locatehash;
+
 
 void source_debug_init(int type,void *data)
 {
@@ -79,9 +88,125 @@ void write_depends(FILE *f)
 }
 
 
-static FILE *open_path(char *compdir,char *path,char *name,char *mode)
+static void *find_filename(hashtable *ht,char *name)
+{
+  hashdata data;
+  char *key;
+
+  if (ht == NULL)
+    return NULL;
+  key = mystrdup(name);
+  strtolower(key);
+  if (!find_name(ht,key,&data))
+    data.ptr = NULL;
+  myfree(key);
+  return data.ptr;
+}
+
+
+static void add_filename(hashtable *ht,char *name,void *ptr)
+{
+  hashdata data;
+  char *key = mystrdup(name);
+
+  strtolower(key);
+  data.ptr = ptr;
+  add_hashentry(ht,key,data);
+}
+
+
+static struct source_file *find_srcfile(char *name)
+{
+  struct source_file *srcfile;
+
+  for (srcfile=find_filename(srchash,name); srcfile;
+       srcfile=srcfile->hashnext) {
+    if (!filenamecmp(srcfile->name,name))
+      break;
+  }
+  return srcfile;
+}
+
+
+/* append a new source file to the list and the index */
+static void add_srcfile(struct source_file *srcfile)
+{
+  struct source_file *sf;
+
+  srcfile->next = srcfile->hashnext = NULL;
+  if (last_source)
+    last_source = last_source->next = srcfile;
+  else
+    first_source = last_source = srcfile;
+
+  if (srchash == NULL) {
+    srchash = new_hashtable(0x100);
+    name_hashtable(srchash,"sources");
+  }
+  if (sf = find_filename(srchash,srcfile->name)) {
+    while (sf->hashnext)
+      sf = sf->hashnext;
+    sf->hashnext = srcfile;
+  }
+  else
+    add_filename(srchash,srcfile->name,srcfile);
+}
+
+
+static struct located *find_located(char *name)
+{
+  struct located *loc;
+
+  for (loc=find_filename(locatehash,name); loc; loc=loc->hashnext) {
+    if (!filenamecmp(loc->name,name))
+      break;
+  }
+  return loc;
+}
+
+
+/* remember where a file was found in the include paths */
+static void add_located(char *name,char *path,struct include_path *ipath)
+{
+  struct located *loc,*l;
+
+  if (loc = find_located(name))
+    myfree(loc->path);
+  else {
+    loc = mymalloc(sizeof(struct located));
+    loc->hashnext = NULL;
+    loc->name = mystrdup(name);
+    if (locatehash == NULL) {
+      locatehash = new_hashtable(0x100);
+      name_hashtable(locatehash,"includes");
+    }
+    if (l = find_filename(locatehash,name)) {
+      while (l->hashnext)
+        l = l->hashnext;
+      l->hashnext = loc;
+    }
+    else
+      add_filename(locatehash,name,loc);
+  }
+  loc->path = mystrdup(path);
+  loc->ipath = ipath;
+}
+
+
+static void set_path_used(char *path_used,char *path)
+{
+  if (path_used != NULL) {
+    if (strlen(path) < MAXPATHLEN)
+      strcpy(path_used,path);
+    else
+      *path_used = '\0';
+  }
+}
+
+
+static FILE *open_path(char *compdir,char *path,char *name,char *mode,
+                       char *pathbuf)
 {
-  char pathbuf[MAXPATHLEN];
   FILE *f;
 
   if (strlen(compdir) + strlen(path) + strlen(name) + 1 <= MAXPATHLEN) {
@@ -99,9 +224,14 @@ static FILE *open_path(char *compdir,char *path,char *name,char *mode)
 }
 
 
-static FILE *locate_file(char *filename,char *mode,struct include_path **ipath_used)
+/* locate and open a file, its full path is copied to path_used, unless
+   NULL, which is set to an empty string when the path is too long */
+static FILE *locate_file(char *filename,char *mode,
+                         struct include_path **ipath_used,char *path_used)
 {
+  char pathbuf[MAXPATHLEN];
   struct include_path *ipath;
+  struct located *loc;
   FILE *f;
 
   if (abs_path(filename)) {
@@ -111,20 +241,33 @@ static FILE *locate_file(char *filename,char *mode,struct include_path **ipath_u
         add_depend(filename);
       if (ipath_used)
         *ipath_used = NULL;  /* no path used, file name was absolute */
+      set_path_used(path_used,filename);
       return f;
     }
   }
   else {
+    if ((loc = find_located(filename)) && (f = fopen(loc->path,mode))) {
+      /* found at the same place as before */
+      if (depend_all || !abs_path(loc->path))
+        add_depend(loc->path);
+      if (ipath_used)
+        *ipath_used = loc->ipath;
+      set_path_used(path_used,loc->path);
+      return f;
+    }
+
     /* locate file name in all known include paths */
     for (ipath=first_incpath; ipath; ipath=ipath->next) {
-      if ((f = open_path(emptystr,ipath->path,filename,mode)) == NULL) {
+      if ((f = open_path(emptystr,ipath->path,filename,mode,pathbuf)) == NULL) {
         if (!nocompdir && compile_dir && !abs_path(ipath->path) &&
-            (f = open_path(compile_dir,ipath->path,filename,mode)))
+            (f = open_path(compile_dir,ipath->path,filename,mode,pathbuf)))
           ipath->compdir_based = 1;
       }
       if (f != NULL) {
+        add_located(filename,pathbuf,ipath);
         if (ipath_used)
           *ipath_used = ipath;
+        set_path_used(path_used,pathbuf);
         return f;
       }
     }
@@ -134,13 +277,38 @@ static FILE *locate_file(char *filename,char *mode,struct include_path **ipath_u
 }
 
 
-static struct source_file *read_source_file(FILE *f)
+static struct source_file *new_srcfile(char *text,size_t size)
 {
   static int srcfileidx;
+  struct source_file *srcfile = mymalloc(sizeof(struct source_file));
+
+  srcfile->next = NULL;
+  srcfile->name = NULL;
+  srcfile->path = NULL;
+  srcfile->incpath = NULL;
+  srcfile->text = text;
+  srcfile->size = size;
+  srcfile->hash = 0;
+  srcfile->index = ++srcfileidx;
+  return srcfile;
+}
+
+
+static struct source_file *read_source_file(FILE *f,int map)
+{
   struct source_file *srcfile;
+  clock_t t0 = profile ? clock() : 0;
   char *text;
   size_t size;
 
+  if (map && (text = map_file(f,&size,2))) {
+    /* mapped file is followed by zeros up to the end of its last page */
+    *(text+size) = '\n';
+    *(text+size+1) = '\0';
+    size++;
+    goto got_text;
+  }
+
   for (text=NULL,size=0; ; size+=SRCREADINC) {
     size_t nchar;
 
@@ -163,18 +331,15 @@ static struct source_file *read_source_file(FILE *f)
       text = "\n";
       size = 1;
     }
-    srcfile = mymalloc(sizeof(struct source_file));
-    srcfile->next = NULL;
-    srcfile->name = NULL;
-    srcfile->incpath = NULL;
-    srcfile->text = text;
-    srcfile->size = size;
-    srcfile->index = ++srcfileidx;
+got_text:
+    srcfile = new_srcfile(text,size);
   }
   else {
     general_error(29,filename);
     srcfile = NULL;
   }
+  if (profile)
+    srcread_time += clock() - t0;
   return srcfile;
 }
 
@@ -215,6 +380,7 @@ source *new_source(char *srcname,struct source_file *srcfile,
   s->param[0] = emptystr;
   s->param_len[0] = 0;
   s->id = id++;	        /* every source has unique id - important for macros */
+  s->curmark = 0;
   s->srcptr = text;
   s->line = 0;
   s->bufsize = INITLINELEN;
@@ -229,6 +395,7 @@ source *new_source(char *srcname,struct source_file *srcfile,
   /* -1 outside of a repetition block */
   s->reptn = cur_src ? cur_src->reptn : -1;
 #endif
+  s->reptchk = NULL;
   return s;
 }
 
@@ -249,10 +416,9 @@ source *stdin_source(void)
 {
   struct source_file *srcfile;
 
-  if (srcfile = read_source_file(stdin)) {
+  if (srcfile = read_source_file(stdin,1)) {
     srcfile->name = "stdin";
-    srcfile->next = first_source;
-    first_source = srcfile;
+    add_srcfile(srcfile);
     cur_src = new_source(srcfile->name,srcfile,srcfile->text,srcfile->size);
     return cur_src;
   }
@@ -260,34 +426,911 @@ source *stdin_source(void)
 }
 
 
+/* Include file cache.
+   While an include file is parsed the first time we record all constant
+   symbols and macros it defines, together with the state of every outside
+   symbol or macro it looked at. Anything else (atoms, nested includes,
+   macro calls, errors, ...) makes the file uncacheable. When a file with
+   the same contents is included again under the same probed state, the
+   recorded definitions are entered directly, without parsing the file.
+   A cache file keeps up to ICVARIANTS recordings, made under different
+   states or options, the most recent first. */
+
+#define ICMAGIC    "VASMIC01"
+#define ICMAGICSZ  8
+#define ICHEADERSZ (ICMAGICSZ+16)
+#define ICEXT      ".vic"
+#define ICVARIANTS 8
+#define ICPROBESYM 'S'
+#define ICPROBEMAC 'M'
+#define ICDEFSYM   'D'
+#define ICDEFMAC   'm'
+#define ICEND      'E'
+#define ICIGNFLAGS (USED|REFERENCED)  /* not compared for symbol probes */
+
+struct icprobe {
+  struct icprobe *next;
+  char *name;
+  int kind;
+  int defined;
+  int type;
+  uint32_t flags;
+  taddr val;
+};
+
+struct iclist {
+  struct iclist *next;
+  void *ptr;
+};
+
+static struct {
+  source *src;
+  uint64_t hash;
+  size_t size;
+  int clev;
+  hashtable *symnames,*macnames;    /* defined while recording */
+  hashtable *symprobes,*macprobes;  /* already probed */
+  struct icprobe *first_probe,*last_probe;
+  struct iclist *first_sym,*last_sym;
+  struct iclist *first_mac,*last_mac;
+} icrec;
+
+/* buffer for reading or building a cache file */
+struct icbuf {
+  unsigned char *base,*p,*end;
+  int err;
+};
+
+static uint64_t inccache_cfg;
+
+
+static uint64_t fnv_hash(uint64_t h,const unsigned char *p,size_t n)
+{
+  const uint64_t prime = ((uint64_t)0x100<<32) | 0x1b3;
+
+  if (h == 0)
+    h = ((uint64_t)0xcbf29ce4<<32) | 0x84222325;
+  while (n--) {
+    h ^= *p++;
+    h *= prime;
+  }
+  return h;
+}
+
+
+/* fold an option, which might influence parsing, into the cache key */
+void inccache_key(const char *s)
+{
+  inccache_cfg = fnv_hash(inccache_cfg,(const unsigned char *)s,strlen(s)+1);
+}
+
+
+static uint64_t srcfile_hash(struct source_file *srcfile)
+{
+  if (srcfile->hash == 0)
+    srcfile->hash = fnv_hash(0,(unsigned char *)srcfile->text,srcfile->size);
+  return srcfile->hash;
+}
+
+
+/* name of the cache file for an include file with the given contents */
+static char *inccache_name(uint64_t hash)
+{
+  static char pathbuf[MAXPATHLEN];
+  static char *dir;
+
+  if (dir == NULL)
+    dir = append_path_delimiter(inccache_dir);
+  if (strlen(dir) + 16 + sizeof(ICEXT) + 4 > MAXPATHLEN)
+    return NULL;
+  sprintf(pathbuf,"%s%08lx%08lx%s",dir,(unsigned long)(uint32_t)(hash>>32),
+          (unsigned long)(uint32_t)hash,ICEXT);
+  return pathbuf;
+}
+
+
+static void put_bytes(struct icbuf *b,const void *p,size_t n)
+{
+  if ((size_t)(b->end - b->p) < n) {
+    size_t used = b->p - b->base;
+    size_t size = (b->end - b->base) * 2 + n + 256;
+
+    b->base = myrealloc(b->base,size);
+    b->p = b->base + used;
+    b->end = b->base + size;
+  }
+  memcpy(b->p,p,n);
+  b->p += n;
+}
+
+
+static void put_num(struct icbuf *b,uint64_t v,int n)
+{
+  unsigned char buf[8];
+  int i;
+
+  for (i=0; i<n; i++) {
+    buf[i] = (unsigned char)(v & 0xff);
+    v >>= 8;
+  }
+  put_bytes(b,buf,n);
+}
+
+
+static void put_str(struct icbuf *b,const char *s,size_t len)
+{
+  put_num(b,(uint64_t)len,4);
+  put_bytes(b,s,len);
+  put_num(b,0,1);
+}
+
+
+static void put_macargs(struct icbuf *b,struct macarg *ma)
+{
+  struct macarg *p;
+  int n;
+
+  for (n=0,p=ma; p; p=p->argnext)
+    n++;
+  put_num(b,(uint64_t)n,4);
+  for (p=ma; p; p=p->argnext) {
+    if (p->arglen == MACARG_REQUIRED)
+      put_num(b,MACARG_REQUIRED,4);
+    else
+      put_str(b,p->argname,p->arglen);
+  }
+}
+
+
+static uint64_t get_num(struct icbuf *b,int n)
+{
+  uint64_t v = 0;
+  int i;
+
+  if (b->end-b->p < n) {
+    b->err = 1;
+    return 0;
+  }
+  for (i=0; i<n; i++)
+    v |= (uint64_t)b->p[i] << (i*8);
+  b->p += n;
+  return v;
+}
+
+
+static char *get_str(struct icbuf *b,size_t *plen)
+{
+  size_t len = (size_t)get_num(b,4);
+  char *s;
+
+  if (plen)
+    *plen = len;
+  if (b->err || len==MACARG_REQUIRED)
+    return NULL;
+  if ((size_t)(b->end-b->p) < len+1 || b->p[len]!=0) {
+    b->err = 1;
+    return NULL;
+  }
+  s = (char *)b->p;
+  b->p += len + 1;
+  return s;
+}
+
+
+static void get_macargs(struct icbuf *b,struct macarg **list)
+{
+  int i,n;
+  size_t len;
+  char *s;
+
+  n = (int)get_num(b,4);
+  for (i=0; i<n && !b->err; i++) {
+    s = get_str(b,&len);
+    if (s==NULL && len!=MACARG_REQUIRED)
+      b->err = 1;
+    else if (list) {
+      if (s != NULL)
+        addmacarg(list,s,s+len);
+      else
+        addmacarg(list,NULL,NULL);  /* no default value */
+    }
+  }
+}
+
+
+/* Source files kept in memory by the parent process of -daemon jobs.
+   Every job inherits them and doesn't need to read them again. After a
+   job has finished, the parent reads the files the job reported, which
+   are new or have changed, together with their include cache files.
+   Before the next job all files are checked again. */
+struct warmfile {
+  struct warmfile *next;
+  char *path;
+  unsigned long size,chtime;    /* stamp of the file when it was read */
+  struct source_file *srcfile;  /* its contents */
+  char *icname;                 /* include cache file, or NULL */
+  unsigned char *icdata;
+  size_t icsize;
+  unsigned long icfsize,icchtime;
+};
+
+static struct warmfile *first_warm;
+
+
+static struct warmfile *find_warm(char *path)
+{
+  struct warmfile *w;
+
+  for (w=first_warm; w; w=w->next) {
+    if (!strcmp(w->path,path))
+      break;
+  }
+  return w;
+}
+
+
+static void free_warm(struct warmfile *w)
+{
+  struct warmfile **pw;
+
+  for (pw=&first_warm; *pw!=w; pw=&(*pw)->next);
+  *pw = w->next;
+  myfree(w->srcfile->text);
+  myfree(w->srcfile);
+  myfree(w->icname);
+  myfree(w->icdata);
+  myfree(w->path);
+  myfree(w);
+}
+
+
+/* read a file completely into memory, NULL when it failed */
+static unsigned char *read_whole(char *name,size_t *psize)
+{
+  unsigned char *data;
+  size_t size;
+  FILE *f;
+
+  if ((f = fopen(name,"rb")) == NULL)
+    return NULL;
+  size = filesize(f);
+  data = mymalloc(size>0?size:1);
+  if (fread(data,1,size,f) != size) {
+    myfree(data);
+    data = NULL;
+  }
+  fclose(f);
+  *psize = size;
+  return data;
+}
+
+
+/* keep the include cache file of a warm source in memory */
+static void warm_inccache(struct warmfile *w)
+{
+  unsigned long size,chtime;
+  char *name;
+
+  if (inccache_dir == NULL)
+    return;
+  if (w->icname == NULL) {
+    if ((name = inccache_name(srcfile_hash(w->srcfile))) == NULL)
+      return;
+    w->icname = mystrdup(name);
+  }
+  if (!file_stamp(w->icname,&size,&chtime)) {
+    size = chtime = 0;  /* no cache file yet */
+  }
+  else if (w->icdata!=NULL && size==w->icfsize && chtime==w->icchtime)
+    return;  /* unchanged */
+  myfree(w->icdata);
+  w->icdata = NULL;
+  w->icfsize = size;
+  w->icchtime = chtime;
+  if (size>0 && (unsigned long)time(NULL)>chtime+1)
+    w->icdata = read_whole(w->icname,&w->icsize);
+}
+
+
+/* Read a source file into memory for the following jobs, or check that
+   the copy is still up to date. Files which were modified in the last
+   seconds are not kept, as another change within the same second would
+   not be noticed. */
+void warm_source(char *path)
+{
+  struct warmfile *w = find_warm(path);
+  struct source_file *srcfile;
+  unsigned long size,chtime;
+  FILE *f;
+
+  if (!file_stamp(path,&size,&chtime) ||
+      (unsigned long)time(NULL)<=chtime+1) {
+    if (w)
+      free_warm(w);
+    return;
+  }
+  if (w!=NULL && (w->size!=size || w->chtime!=chtime)) {
+    free_warm(w);
+    w = NULL;
+  }
+  if (w == NULL) {
+    if ((f = fopen(path,"r")) == NULL)
+      return;
+    srcfile = read_source_file(f,0);  /* not mapped, so it can be freed */
+    fclose(f);
+    if (srcfile == NULL)
+      return;
+    w = mycalloc(sizeof(struct warmfile));
+    w->path = mystrdup(path);
+    w->size = size;
+    w->chtime = chtime;
+    w->srcfile = srcfile;
+    w->next = first_warm;
+    first_warm = w;
+  }
+  warm_inccache(w);
+}
+
+
+/* check all warm sources, before starting the next job */
+void refresh_warm_sources(void)
+{
+  struct warmfile *w,*next;
+
+  for (w=first_warm; w; w=next) {
+    next = w->next;
+    warm_source(w->path);
+  }
+}
+
+
+/* write the paths of all source files read by this job, one per line */
+void report_sources(FILE *f)
+{
+  struct source_file *srcfile;
+
+  for (srcfile=first_source; srcfile; srcfile=srcfile->next) {
+    if (srcfile->path)
+      fprintf(f,"%s\n",srcfile->path);
+  }
+}
+
+
+/* a new source file for the contents of a warm source */
+static struct source_file *warm_srcfile(char *path)
+{
+  struct warmfile *w;
+  struct source_file *srcfile;
+
+  if (*path=='\0' || (w = find_warm(path)) == NULL)
+    return NULL;
+  srcfile = new_srcfile(w->srcfile->text,w->srcfile->size);
+  srcfile->hash = w->srcfile->hash;
+  return srcfile;
+}
+
+
+/* read the cache file for the given contents, check its header */
+static int inccache_load(struct icbuf *b,uint64_t hash,size_t srcsize)
+{
+  char *name = inccache_name(hash);
+  struct warmfile *w;
+  size_t size;
+  FILE *f;
+
+  for (w=first_warm; w; w=w->next) {
+    if (w->icdata!=NULL && w->srcfile->hash==hash)
+      break;
+  }
+  if (w != NULL) {
+    /* kept in memory by the parent of this job */
+    size = w->icsize;
+    b->base = b->p = mymalloc(size);
+    memcpy(b->base,w->icdata,size);
+  }
+  else {
+    if (name==NULL || (f = fopen(name,"rb"))==NULL)
+      return 0;
+    size = filesize(f);
+    b->base = b->p = mymalloc(size>0?size:1);
+    if (fread(b->base,1,size,f) != size)
+      size = 0;
+    fclose(f);
+  }
+  b->end = b->base + size;
+  b->err = 0;
+  if (size<ICHEADERSZ || memcmp(b->base,ICMAGIC,ICMAGICSZ)) {
+    b->err = 1;
+  }
+  else {
+    b->p += ICMAGICSZ;
+    if (get_num(b,8)!=hash || get_num(b,8)!=(uint64_t)srcsize)
+      b->err = 1;
+  }
+  if (b->err) {
+    myfree(b->base);
+    return 0;
+  }
+  return 1;
+}
+
+
+/* write a new cache file atomically, by renaming a temporary file */
+static void inccache_save(struct icbuf *b,uint64_t hash)
+{
+  char *name = inccache_name(hash);
+  char tmpname[MAXPATHLEN];
+  size_t size = b->p - b->base;
+  FILE *f;
+
+  if (name == NULL)
+    return;
+  sprintf(tmpname,"%s.tmp",name);
+  if (f = fopen(tmpname,"wb")) {
+    int err = fwrite(b->base,1,size,f) != size;
+
+    if (fclose(f) || err)
+      remove(tmpname);
+    else if (rename(tmpname,name)) {
+      remove(name);
+      if (rename(tmpname,name))
+        remove(tmpname);
+    }
+  }
+}
+
+
+static void icrec_free(void)
+{
+  struct icprobe *p,*pnext;
+  struct iclist *l,*lnext;
+
+  for (p=icrec.first_probe; p; p=pnext) {
+    pnext = p->next;
+    myfree(p->name);
+    myfree(p);
+  }
+  for (l=icrec.first_sym; l; l=lnext) {
+    lnext = l->next;
+    myfree(l);
+  }
+  for (l=icrec.first_mac; l; l=lnext) {
+    lnext = l->next;
+    myfree(l);
+  }
+  icrec.symnames = free_hashtable(icrec.symnames);
+  icrec.macnames = free_hashtable(icrec.macnames);
+  icrec.symprobes = free_hashtable(icrec.symprobes);
+  icrec.macprobes = free_hashtable(icrec.macprobes);
+  icrec.first_probe = icrec.last_probe = NULL;
+  icrec.first_sym = icrec.last_sym = NULL;
+  icrec.first_mac = icrec.last_mac = NULL;
+  icrec.src = NULL;
+  inccache_recording = 0;
+}
+
+
+static void iclist_add(struct iclist **first,struct iclist **last,void *ptr)
+{
+  struct iclist *new = mymalloc(sizeof(struct iclist));
+
+  new->next = NULL;
+  new->ptr = ptr;
+  if (*last)
+    *last = (*last)->next = new;
+  else
+    *first = *last = new;
+}
+
+
+static void icprobe_add(hashtable *ht,struct icprobe *p)
+{
+  hashdata data;
+
+  p->next = NULL;
+  if (icrec.last_probe)
+    icrec.last_probe = icrec.last_probe->next = p;
+  else
+    icrec.first_probe = icrec.last_probe = p;
+  data.ptr = p;
+  add_hashentry(ht,p->name,data);
+}
+
+
+#ifdef INCCACHE_SAFE
+static void inccache_start(source *src)
+{
+  if (!produce_listing && INCCACHE_SAFE) {
+    icrec.src = src;
+    icrec.hash = srcfile_hash(src->srcfile);
+    icrec.size = src->srcfile->size;
+    icrec.clev = clev;
+    icrec.symnames = new_hashtable(0x100);
+    icrec.macnames = new_hashtable(0x40);
+    icrec.symprobes = new_hashtable(0x100);
+    icrec.macprobes = new_hashtable(0x40);
+    inccache_recording = 1;
+  }
+}
+#else
+#define inccache_start(src)  /* the syntax module can't replay includes */
+#endif
+
+
+/* the include file being recorded did something which we cannot replay */
+void inccache_taint(void)
+{
+  if (inccache_recording)
+    icrec_free();
+}
+
+
+/* remember the state of a symbol from outside, when looked up first */
+void inccache_symprobe(const char *name,symbol *sym)
+{
+  struct icprobe *p;
+  hashdata data;
+  taddr val = 0;
+
+  if (find_name(icrec.symnames,name,&data) ||
+      find_name(icrec.symprobes,name,&data))
+    return;
+  if (sym!=NULL && sym->type==EXPRESSION && !eval_expr(sym->expr,&val,NULL,0)) {
+    inccache_taint();  /* depends on a non-constant expression */
+    return;
+  }
+  p = mymalloc(sizeof(struct icprobe));
+  p->name = mystrdup(name);
+  p->kind = ICPROBESYM;
+  p->defined = sym != NULL;
+  p->type = sym ? sym->type : 0;
+  p->flags = sym ? (sym->flags & ~ICIGNFLAGS) : 0;
+  p->val = val;
+  icprobe_add(icrec.symprobes,p);
+}
+
+
+/* symbol is defined or modified by the include file being recorded */
+void inccache_touch(symbol *sym)
+{
+  hashdata data;
+
+  if (!find_name(icrec.symnames,sym->name,&data)) {
+    data.ptr = sym;
+    add_hashentry(icrec.symnames,sym->name,data);
+    iclist_add(&icrec.first_sym,&icrec.last_sym,sym);
+  }
+}
+
+
+/* remember whether a macro from outside existed, when looked up first */
+void inccache_macprobe(char *name,int len,macro *m)
+{
+  struct icprobe *p;
+  hashdata data;
+  char *s = cnvstr(name,len);
+
+  if (nocase_macros)
+    strtolower(s);
+  if (find_name(icrec.macnames,s,&data) ||
+      find_name(icrec.macprobes,s,&data)) {
+    myfree(s);
+    return;
+  }
+  p = mymalloc(sizeof(struct icprobe));
+  p->name = s;
+  p->kind = ICPROBEMAC;
+  p->defined = m != NULL;
+  p->type = 0;
+  p->flags = 0;
+  p->val = 0;
+  icprobe_add(icrec.macprobes,p);
+}
+
+
+/* a new macro was defined by the include file being recorded */
+void inccache_macro(macro *m)
+{
+  hashdata data;
+
+  if (m->defsrc!=icrec.src || m->text==NULL) {
+    inccache_taint();
+    return;
+  }
+  data.ptr = m;
+  add_hashentry(icrec.macnames,m->name,data);
+  iclist_add(&icrec.first_mac,&icrec.last_mac,m);
+}
+
+
+/* expression only refers to constants and symbols which cannot change */
+static int stable_expr(expr *tree)
+{
+  if (tree == NULL)
+    return 1;
+  switch (tree->type) {
+    case NUM:
+      return 1;
+    case HUG:
+    case FLT:
+      return 0;
+    case SYM:
+      return tree->c.sym->type==EXPRESSION &&
+             (tree->c.sym->flags & (EQUATE|INEVAL))==EQUATE &&
+             stable_expr(tree->c.sym->expr);
+  }
+  return stable_expr(tree->left) && stable_expr(tree->right);
+}
+
+
+/* build a new variant from the recording, followed by the old variants */
+static void inccache_write(void)
+{
+  struct icbuf b,old;
+  struct icprobe *p;
+  struct iclist *l;
+  symbol *sym;
+  macro *m;
+  size_t vstart,len;
+  taddr val;
+  int n;
+
+  for (l=icrec.first_sym; l; l=l->next) {
+    sym = l->ptr;
+    if (sym->type!=EXPRESSION || !stable_expr(sym->expr) ||
+        !eval_expr(sym->expr,&val,NULL,0))
+      return;  /* not a constant */
+  }
+
+  b.base = b.p = b.end = NULL;
+  put_bytes(&b,ICMAGIC,ICMAGICSZ);
+  put_num(&b,icrec.hash,8);
+  put_num(&b,(uint64_t)icrec.size,8);
+  vstart = b.p - b.base;
+  put_num(&b,0,4);  /* length of this variant, set below */
+  put_num(&b,inccache_cfg,8);
+
+  for (p=icrec.first_probe; p; p=p->next) {
+    put_num(&b,p->kind,1);
+    put_str(&b,p->name,strlen(p->name));
+    put_num(&b,(uint64_t)p->defined,1);
+    if (p->kind == ICPROBESYM) {
+      put_num(&b,(uint64_t)p->type,1);
+      put_num(&b,(uint64_t)p->flags,4);
+      put_num(&b,(uint64_t)(int64_t)p->val,8);
+    }
+  }
+
+  for (l=icrec.first_sym; l; l=l->next) {
+    sym = l->ptr;
+    eval_expr(sym->expr,&val,NULL,0);
+    put_num(&b,ICDEFSYM,1);
+    put_str(&b,sym->name,strlen(sym->name));
+    put_num(&b,(uint64_t)sym->flags,4);
+    put_num(&b,(uint64_t)(int64_t)val,8);
+  }
+
+  for (l=icrec.first_mac; l; l=l->next) {
+    m = l->ptr;
+    put_num(&b,ICDEFMAC,1);
+    put_str(&b,m->name,strlen(m->name));
+    put_num(&b,(uint64_t)(m->text - icrec.src->text),8);
+    put_num(&b,(uint64_t)m->size,8);
+    put_num(&b,(uint64_t)m->defline,4);
+    put_num(&b,(uint64_t)m->srcdebug,1);
+    put_num(&b,(uint64_t)(uint32_t)m->num_argnames,4);
+    put_num(&b,(uint64_t)(uint32_t)m->vararg,4);
+    put_macargs(&b,m->argnames);
+    put_macargs(&b,m->defaults);
+  }
+  put_num(&b,ICEND,1);
+
+  /* patch the variant length */
+  len = b.p - b.base - vstart - 4;
+  for (n=0; n<4; n++)
+    b.base[vstart+n] = (unsigned char)((len >> (n*8)) & 0xff);
+
+  /* append the older variants */
+  if (inccache_load(&old,icrec.hash,icrec.size)) {
+    for (n=1; n<ICVARIANTS && !old.err && old.p<old.end; n++) {
+      len = (size_t)get_num(&old,4);
+      if (old.err || (size_t)(old.end-old.p)<len)
+        break;
+      put_num(&b,(uint64_t)len,4);
+      put_bytes(&b,old.p,len);
+      old.p += len;
+    }
+    myfree(old.base);
+  }
+
+  inccache_save(&b,icrec.hash);
+  myfree(b.base);
+}
+
+
+/* source instance is left, write cache file when it was recorded */
+void inccache_end(source *src)
+{
+  if (src == icrec.src) {
+    if (clev == icrec.clev)
+      inccache_write();
+    icrec_free();
+  }
+}
+
+
+/* Check the probes of a variant in the first pass, and replay its
+   definitions in the second pass. Returns zero when not applicable. */
+static int icvariant(struct icbuf *b,struct source_file *srcfile,int pass)
+{
+  source *defsrc = NULL;
+  int kind = 0;
+
+  if (get_num(b,8) != inccache_cfg)
+    return 0;
+
+  if (pass) {
+    /* a new source instance, as defining source of all macros */
+    defsrc = new_source(srcfile->name,srcfile,srcfile->text,srcfile->size);
+    myfree(defsrc->linebuf);
+    defsrc->linebuf = NULL;
+  }
+
+  while (!b->err && b->p<b->end && (kind = *b->p++)!=ICEND) {
+    char *name = get_str(b,NULL);
+    symbol *sym;
+
+    if (name == NULL)
+      b->err = 1;
+
+    else if (kind == ICPROBESYM) {
+      int defined = (int)get_num(b,1);
+      int type = (int)get_num(b,1);
+      uint32_t flags = (uint32_t)get_num(b,4);
+      taddr val = (taddr)(int64_t)get_num(b,8);
+      taddr v;
+
+      if (!pass && !b->err) {
+        sym = find_symbol(name);
+        if ((sym!=NULL) != defined)
+          return 0;
+        if (sym!=NULL && (sym->type!=type ||
+            (sym->flags&~ICIGNFLAGS)!=flags ||
+            (type==EXPRESSION &&
+             (!eval_expr(sym->expr,&v,NULL,0) || v!=val))))
+          return 0;
+      }
+    }
+
+    else if (kind == ICPROBEMAC) {
+      int defined = (int)get_num(b,1);
+
+      if (!pass && (find_macro(name,strlen(name))!=NULL) != defined)
+        return 0;
+    }
+
+    else if (kind == ICDEFSYM) {
+      uint32_t flags = (uint32_t)get_num(b,4);
+      taddr val = (taddr)(int64_t)get_num(b,8);
+
+      if (pass && !b->err) {
+        if (sym = find_symbol(name)) {
+          sym->type = EXPRESSION;
+          sym->sec = NULL;
+          sym->expr = number_expr(val);
+          sym->flags = flags | (sym->flags & ICIGNFLAGS);
+        }
+        else
+          new_abs(name,number_expr(val))->flags = flags;
+      }
+    }
+
+    else if (kind == ICDEFMAC) {
+      size_t offs = (size_t)get_num(b,8);
+      size_t msize = (size_t)get_num(b,8);
+      int defline = (int)get_num(b,4);
+      int srcdebug = (int)get_num(b,1);
+      int num_argnames = (int)(int32_t)get_num(b,4);
+      int vararg = (int)(int32_t)get_num(b,4);
+
+      if (offs>srcfile->size || msize>srcfile->size-offs)
+        b->err = 1;
+      if (pass && !b->err) {
+        macro *m = mymalloc(sizeof(macro));
+
+        m->name = mystrdup(name);
+        m->text = srcfile->text + offs;
+        m->size = msize;
+        m->defsrc = defsrc;
+        m->defline = defline;
+        m->srcdebug = srcdebug;
+        m->num_argnames = num_argnames;
+        m->argnames = m->defaults = NULL;
+        m->vararg = vararg;
+        m->recursions = 0;
+        get_macargs(b,&m->argnames);
+        get_macargs(b,&m->defaults);
+        define_macro(m);
+      }
+      else {
+        get_macargs(b,NULL);
+        get_macargs(b,NULL);
+      }
+    }
+
+    else
+      b->err = 1;
+  }
+
+  return !b->err && kind==ICEND;
+}
+
+
+/* look for a matching variant in the cache file and replay it */
+static int inccache_replay(struct source_file *srcfile)
+{
+  struct icbuf b,v;
+  int found = 0;
+
+#ifdef INCCACHE_SAFE
+  if (produce_listing || !(INCCACHE_SAFE))
+    return 0;
+#else
+  return 0;
+#endif
+  if (!inccache_load(&b,srcfile_hash(srcfile),srcfile->size))
+    return 0;
+
+  while (!found && b.p<b.end) {
+    size_t len = (size_t)get_num(&b,4);
+
+    if (b.err || (size_t)(b.end-b.p)<len)
+      break;
+    v.base = v.p = b.p;
+    v.end = b.p + len;
+    v.err = 0;
+    if (icvariant(&v,srcfile,0)) {
+      v.p = v.base;
+      if (!icvariant(&v,srcfile,1))
+        ierror(0);  /* was consistent in the first pass */
+      found = 1;
+    }
+    b.p += len;
+  }
+
+  myfree(b.base);
+  return found;
+}
+
+
 source *include_source(char *inc_name)
 {
-  struct source_file **nptr = &first_source;
   struct source_file *srcfile;
   char *filename;
 
+  if (inccache_recording)
+    inccache_taint();  /* nested includes are not cached */
   filename = convert_path(inc_name);
 
   /* check whether this source file name was already included */
-  while (srcfile = *nptr) {
-    if (!filenamecmp(srcfile->name,filename)) {
-      myfree(filename);
-      nptr = NULL;  /* reuse existing source in memory */
-      break;
-    }
-    nptr = &srcfile->next;
+  if (srcfile = find_srcfile(filename)) {
+    myfree(filename);  /* reuse existing source in memory */
+    if (ignore_multinc)
+      return NULL;  /* ignore multiple inclusion of this source completely */
   }
-
-  if (nptr != NULL) {
+  else {
     /* allocate, locate and read a new source file */
+    char path[MAXPATHLEN];
     struct include_path *ipath;
     FILE *f;
 
-    if (f = locate_file(filename,"r",&ipath)) {
-      if (srcfile = read_source_file(f)) {
+    if (f = locate_file(filename,"r",&ipath,path)) {
+      if ((srcfile = warm_srcfile(path)) != NULL ||
+          (srcfile = read_source_file(f,1)) != NULL) {
         srcfile->name = filename;
+        srcfile->path = *path ? mystrdup(path) : NULL;
         srcfile->incpath = ipath;
-        *nptr = srcfile;
+        add_srcfile(srcfile);
         fclose(f);
       }
       else {
@@ -296,10 +1339,15 @@ source *include_source(char *inc_name)
       }
     }
   }
-  else if (ignore_multinc)
-    return NULL;  /* ignore multiple inclusion of this source completely */
-  /* otherwise reuse existing source file instance */
 
+  if (inccache_dir!=NULL && cur_src!=NULL) {
+    /* try to replay its definitions from the include cache, or record them */
+    if (inccache_replay(srcfile))
+      return NULL;
+    cur_src = new_source(srcfile->name,srcfile,srcfile->text,srcfile->size);
+    inccache_start(cur_src);
+    return cur_src;
+  }
   return cur_src = new_source(srcfile->name,srcfile,srcfile->text,srcfile->size);
 }
 
@@ -307,12 +1355,15 @@ source *include_source(char *inc_name)
 void include_binary_file(char *inname,long nbskip,unsigned long nbkeep)
 /* locate a binary file and convert into a data atom */
 {
-  char *filename;
+  char *filename,*map;
   FILE *f;
 
   filename = convert_path(inname);
-  if (f = locate_file(filename,"rb",NULL)) {
-    size_t size = filesize(f);
+  if (f = locate_file(filename,"rb",NULL,NULL)) {
+    size_t size;
+
+    if ((map = map_file(f,&size,0)) == NULL)
+      size = filesize(f);
 
     if (size > 0) {
       if (nbskip>=0 && (size_t)nbskip<=size) {
@@ -323,12 +1374,18 @@ void include_binary_file(char *inname,long nbskip,unsigned long nbkeep)
         else
           db->size = nbkeep;
 
-        db->data = mymalloc(db->size);
-        if (nbskip > 0)
-          fseek(f,nbskip,SEEK_SET);
+        if (map != NULL) {
+          /* refer directly to the mapped file, which is never unmapped */
+          db->data = (unsigned char *)map + nbskip;
+        }
+        else {
+          db->data = mymalloc(db->size);
+          if (nbskip > 0)
+            fseek(f,nbskip,SEEK_SET);
 
-        if (fread(db->data,1,db->size,f) != db->size)
-          general_error(29,filename);  /* read error */
+          if (fread(db->data,1,db->size,f) != db->size)
+            general_error(29,filename);  /* read error */
+        }
         add_atom(0,new_data_atom(db,1));
       }
       else
@@ -14,11 +14,22 @@ struct include_path {
 /* source files */
 struct source_file {
   struct source_file *next;
+  struct source_file *hashnext;  /* same name, when ignoring case */
   struct include_path *incpath;
   int index;
   char *name;
+  char *path;     /* file as it was opened, NULL for stdin */
   char *text;
   size_t size;
+  uint64_t hash;  /* content hash for the include cache, 0 when unknown */
+};
+
+/* cached result of an include path search */
+struct located {
+  struct located *hashnext;
+  char *name;
+  char *path;  /* full path of the file, as it was opened */
+  struct include_path *ipath;
 };
 
 /* source texts (main file, include files or macros) */
@@ -47,6 +58,7 @@ struct source {
   int qual_len[MAX_QUALIFIERS];
 #endif
   unsigned long id;
+  int curmark;  /* next span end in a compiled macro body */
   char *srcptr;
   int line;
   size_t bufsize;
@@ -60,6 +72,7 @@ struct source {
 #ifdef REPTNSYM
   long reptn;
 #endif
+  struct reptcheck *reptchk;  /* invariance check of a repeat-block */
 };
 
 #define DEPEND_LIST     1
@@ -72,6 +85,9 @@ struct deplist {
 
 extern char *compile_dir;
 extern int ignore_multinc,nocompdir,depend,depend_all;
+extern char *inccache_dir;
+extern int inccache_recording;
+extern clock_t srcread_time;
 
 void write_depends(FILE *);
 source *new_source(char *,struct source_file *,char *,size_t);
@@ -81,5 +97,15 @@ source *include_source(char *);
 void include_binary_file(char *,long,unsigned long);
 void source_debug_init(int,void *);
 struct include_path *new_include_path(char *);
+void warm_source(char *);
+void refresh_warm_sources(void);
+void report_sources(FILE *);
+void inccache_key(const char *);
+void inccache_taint(void);
+void inccache_symprobe(const char *,symbol *);
+void inccache_touch(symbol *);
+void inccache_macprobe(char *,int,macro *);
+void inccache_macro(macro *);
+void inccache_end(source *);
 
 #endif /* SOURCE_H */
@@ -4,6 +4,7 @@
 #include <math.h>
 #include "vasm.h"
 #include "supp.h"
+#include "osdep.h"
 
 
 void initlist(struct list *l)
@@ -50,10 +51,14 @@ struct node *remhead(struct list *l)
 }
 
 
+THREADLOCAL unsigned long num_mallocs;
+
 void *mymalloc(size_t sz)
 {
   size_t *p;
 
+  num_mallocs++;
+
   /* workaround for Electric Fence on 64-bit RISC */
   if (sz)
     sz = (sz + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1);
@@ -75,6 +80,8 @@ void *mymalloc(size_t sz)
     if(!p)
       general_error(17);
   }
+  if (mem_log)
+    log_mem(ML_MALLOC,NULL,p);
   return p;
 }
 
@@ -90,8 +97,22 @@ void *mycalloc(size_t sz)
 
 void *myrealloc(void *old,size_t sz)
 {
+  struct memlogentry *e = NULL;
   size_t *p;
 
+  if (mem_log) {
+    size_t i;
+
+    if (old == NULL)
+      return mymalloc(sz);
+    for (i=mem_log->n; i>0; i--) {
+      e = &mem_log->e[i-1];
+      if (e->obj==old && e->kind==ML_MALLOC)
+        break;
+    }
+    if (i == 0)  /* a worker may only move the memory it allocated */
+      longjmp(*error_trap,1);
+  }
   if (debug) {
     p = realloc(old?((size_t *)old)-2:0,sz+2*sizeof(size_t));
     if (!p)
@@ -104,12 +125,18 @@ void *myrealloc(void *old,size_t sz)
     if (!p)
       general_error(17);
   }
+  if (e)
+    e->obj = p;
   return p;
 }
 
 
 void myfree(void *p)
 {
+  if (p && mem_log) {
+    log_mem(ML_MALLOC|ML_FREE,NULL,p);
+    return;
+  }
   if (p) {
     if (debug) {
       size_t *myp = (size_t *)p;
@@ -123,6 +150,195 @@ void myfree(void *p)
 }
 
 
+
+mempool *first_pool;
+
+/* number of objects per pool block */
+#define POOLBLKOBJS(p) \
+  (MEMPOOLBLOCK/(p)->objsize<16 ? 16 : MEMPOOLBLOCK/(p)->objsize)
+
+static void pool_init(mempool *p)
+{
+  p->objsize = (p->objsize + MEMPOOLALIGN - 1) & ~(MEMPOOLALIGN - 1);
+  if (p->objsize < sizeof(void *))
+    p->objsize = sizeof(void *);
+  p->nextpool = first_pool;
+  first_pool = p;
+  p->init = 1;
+}
+
+
+static void *pool_get(mempool *p)
+{
+  void *obj;
+
+  if (!p->init)
+    pool_init(p);
+  p->allocs++;
+  if (debug)
+    return mymalloc(p->objsize);  /* keep the checks of mymalloc() */
+
+  if (obj = p->freelist) {
+    p->freelist = *(void **)obj;
+    return obj;
+  }
+  if ((size_t)(p->end - p->next) < p->objsize) {
+    size_t n = POOLBLKOBJS(p);
+
+    p->next = mymalloc(n * p->objsize);
+    p->end = p->next + n * p->objsize;
+    p->blocks++;
+    p->bytes += n * p->objsize;
+  }
+  obj = p->next;
+  p->next += p->objsize;
+  return obj;
+}
+
+
+void *pool_alloc(mempool *p)
+/* allocate one object from a pool */
+{
+  memlog *l = mem_log;
+  void *obj;
+
+  if (threads_running) {
+    /* pools are shared by all worker threads, their blocks are not logged */
+    mem_log = NULL;
+    lock_threads();
+    obj = pool_get(p);
+    unlock_threads();
+    if (mem_log = l)
+      log_mem(ML_POOL,p,obj);
+    return obj;
+  }
+  return pool_get(p);
+}
+
+
+void *pool_carve(mempool *p,memchunk *c,size_t sz)
+/* Allocate sz bytes from the current block of chunk c, which are accounted
+   to pool p. Consecutive objects of a chunk are adjacent in memory, but
+   they can never be freed. */
+{
+  void *obj;
+
+  if (!p->init)
+    pool_init(p);
+  p->allocs++;
+  sz = (sz + MEMPOOLALIGN - 1) & ~(MEMPOOLALIGN - 1);
+  if (debug || sz > MEMCHUNKBLOCK/4) {
+    p->bytes += sz;
+    return mymalloc(sz);  /* large objects get their own block */
+  }
+  if ((size_t)(c->end - c->next) < sz) {
+    c->next = mymalloc(MEMCHUNKBLOCK);
+    c->end = c->next + MEMCHUNKBLOCK;
+    p->blocks++;
+    p->bytes += MEMCHUNKBLOCK;
+  }
+  obj = c->next;
+  c->next += sz;
+  return obj;
+}
+
+
+void pool_free(mempool *p,void *obj)
+/* return an object to its pool */
+{
+  if (obj && mem_log) {
+    log_mem(ML_POOL|ML_FREE,p,obj);
+    return;
+  }
+  if (obj) {
+    if (threads_running)
+      lock_threads();  /* a worker rolls back its memory log */
+    p->frees++;
+    if (debug)
+      myfree(obj);
+    else {
+      *(void **)obj = p->freelist;
+      p->freelist = obj;
+    }
+    if (threads_running)
+      unlock_threads();
+  }
+}
+
+
+THREADLOCAL memlog *mem_log;  /* set while a worker evaluates an atom */
+
+void log_mem(int kind,mempool *p,void *obj)
+/* record an object allocated or freed by a worker thread */
+{
+  memlog *l = mem_log;
+
+  mem_log = NULL;  /* the log's own memory is not recorded */
+  if (l->n >= l->max) {
+    l->max = l->max ? l->max*2 : 16;
+    l->e = myrealloc(l->e,l->max*sizeof(struct memlogentry));
+  }
+  l->e[l->n].kind = kind;
+  l->e[l->n].pool = p;
+  l->e[l->n++].obj = obj;
+  mem_log = l;
+}
+
+
+static void release(int kind,mempool *p,void *obj)
+{
+  if (kind & ML_POOL)
+    pool_free(p,obj);
+  else if (kind & ML_EXPR)
+    free_expr(obj);
+  else
+    myfree(obj);
+}
+
+
+void commit_mem(memlog *l)
+/* the worker's result was taken: free what it has freed */
+{
+  size_t i;
+
+  for (i=0; i<l->n; i++) {
+    if (l->e[i].kind & ML_FREE)
+      release(l->e[i].kind,l->e[i].pool,l->e[i].obj);
+  }
+  myfree(l->e);
+  l->e = NULL;
+  l->n = l->max = 0;
+}
+
+
+void rollback_mem(memlog *l)
+/* the worker's result was dropped: free what it has allocated */
+{
+  size_t i;
+
+  for (i=l->n; i>0; i--) {
+    if (!(l->e[i-1].kind & ML_FREE))
+      release(l->e[i-1].kind,l->e[i-1].pool,l->e[i-1].obj);
+  }
+  myfree(l->e);
+  l->e = NULL;
+  l->n = l->max = 0;
+}
+
+
+void print_pool_stats(FILE *f)
+{
+  mempool *p;
+
+  fprintf(f,"\nMemory pools:\n");
+  for (p=first_pool; p; p=p->nextpool) {
+    fprintf(f,"%-12s %10lu allocs %10lu frees %4lu bytes each "
+            "%12lu bytes in %lu blocks\n",
+            p->name,p->allocs,p->frees,(unsigned long)p->objsize,
+            p->bytes,p->blocks);
+  }
+}
+
 int field_overflow(int signedbits,size_t numbits,taddr bitval)
 {
   if (signedbits) {
@@ -361,44 +577,28 @@ void fw8(FILE *f,uint8_t x)
 
 void fw16(FILE *f,uint16_t x,int be)
 {
-  if (be) {
-    fw8(f,(x>>8) & 0xff);
-    fw8(f,x & 0xff);
-  }
-  else {
-    fw8(f,x & 0xff);
-    fw8(f,(x>>8) & 0xff);
-  }
+  uint8_t buf[2];
+
+  setval(be,buf,2,x);
+  fwdata(f,buf,2);
 }
 
 
 void fw24(FILE *f,uint32_t x,int be)
 {
-  if (be) {
-    fw8(f,(x>>16) & 0xff);
-    fw16(f,(uint16_t)x,1);
-  }
-  else {
-    fw16(f,(uint16_t)x,0);
-    fw8(f,(x>>16) & 0xff);
-  }
+  uint8_t buf[3];
+
+  setval(be,buf,3,x);
+  fwdata(f,buf,3);
 }
 
 
 void fw32(FILE *f,uint32_t x,int be)
 {
-  if (be) {
-    fw8(f,(x>>24) & 0xff);
-    fw8(f,(x>>16) & 0xff);
-    fw8(f,(x>>8) & 0xff);
-    fw8(f,x & 0xff);
-  }
-  else {
-    fw8(f,x & 0xff);
-    fw8(f,(x>>8) & 0xff);
-    fw8(f,(x>>16) & 0xff);
-    fw8(f,(x>>24) & 0xff);
-  }
+  uint8_t buf[4];
+
+  setval(be,buf,4,x);
+  fwdata(f,buf,4);
 }
 
 
@@ -411,25 +611,71 @@ void fwdata(FILE *f,const void *d,size_t n)
 }
 
 
-void fwsblock(FILE *f,sblock *sb)
+/* write a pattern of patlen bytes n times, in chunks of up to FWFILLBUF */
+void fwfill(FILE *f,const uint8_t *pat,size_t patlen,size_t n)
 {
-  size_t i;
+  static uint8_t buf[FWFILLBUF];
+  size_t reps,len,i;
+
+  if (n==0 || patlen==0)
+    return;
+  if (patlen > FWFILLBUF/2) {
+    while (n--)
+      fwdata(f,pat,patlen);
+    return;
+  }
 
-  for (i=0; i<sb->space; i++) {
-    if (!fwrite(sb->fill,sb->size,1,f))
+  /* replicate the pattern as often as needed, but not beyond the buffer */
+  reps = FWFILLBUF / patlen;
+  if (reps > n)
+    reps = n;
+  len = reps * patlen;
+  for (i=0; i<len; i+=patlen)
+    memcpy(buf+i,pat,patlen);
+
+  for (; n>=reps; n-=reps) {
+    if (fwrite(buf,1,len,f) != len)
       output_error(2);  /* write error */
   }
+  fwdata(f,buf,n*patlen);
 }
 
 
-void fwspace(FILE *f,size_t n)
+void fwsblock(FILE *f,sblock *sb)
 {
-  size_t i;
+  fwfill(f,sb->fill,sb->size,sb->space);
+}
 
-  for (i=0; i<n; i++) {
-    if (fputc(0,f) == EOF)
-      output_error(2);  /* write error */
+
+/* returns true when a fill pattern consists of zeros only */
+int zero_pattern(const uint8_t *pat,size_t patlen)
+{
+  while (patlen--) {
+    if (*pat++)
+      return 0;
   }
+  return 1;
+}
+
+
+void fwspace(FILE *f,size_t n)
+{
+  static const uint8_t zero = 0;
+
+  fwfill(f,&zero,1,n);
+}
+
+
+/* Write n zero bytes to a stream, which is known to be positioned
+   at its end. Large gaps are skipped by seeking, which leaves a hole
+   in sparse files. Only the last byte is really written, to make the
+   file grow. Falls back to writing, when the stream cannot seek. */
+void fwzeros(FILE *f,size_t n)
+{
+  if (n>=FWSEEKMIN && n-1<=LONG_MAX && fseek(f,(long)(n-1),SEEK_CUR)==0)
+    fw8(f,0);
+  else
+    fwspace(f,n);
 }
 
 
@@ -450,11 +696,8 @@ int fwalignpattern(FILE *f,taddr n,uint8_t *pat,int patlen)
   }
 
   /* write alignment pattern */
-  while (n >= patlen) {
-    if (!fwrite(pat,patlen,1,f))
-      output_error(2);  /* write error */
-    n -= patlen;
-  }
+  fwfill(f,pat,patlen,n/patlen);
+  n %= patlen;
 
   while (n--) {
     align_warning = 1;
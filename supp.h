@@ -20,10 +20,60 @@ void addtail(struct list *,struct node *);
 struct node *remnode(struct node *);
 struct node *remhead(struct list *);
 
+/* pool of fixed-size objects, carved from large blocks */
+struct mempool {
+  const char *name;
+  size_t objsize;
+  char *next,*end;        /* free space in the current block */
+  void *freelist;         /* objects returned by pool_free() */
+  unsigned long blocks,allocs,frees,bytes;
+  struct mempool *nextpool;
+  int init;
+};
+#define MEMPOOL(name,size) { (name),(size),NULL,NULL,NULL,0,0,0,0,NULL,0 }
+#define MEMPOOLBLOCK 0x10000
+#define MEMPOOLALIGN 8
+
+/* current block of variable-sized objects, accounted to a pool */
+typedef struct memchunk {
+  char *next,*end;
+} memchunk;
+#define MEMCHUNKBLOCK 0x10000
+
+/* Memory log of a worker thread (see error_trap). The objects it
+   allocates are recorded, to release them when its result is dropped.
+   The objects it frees may still be shared with the serial pass, so
+   they are only released when its result is taken. */
+struct memlogentry {
+  int kind;
+  mempool *pool;
+  void *obj;
+};
+#define ML_FREE 1    /* freed, otherwise allocated */
+#define ML_MALLOC 0  /* mymalloc() */
+#define ML_POOL 2    /* pool_alloc() */
+#define ML_EXPR 4    /* expression tree for free_expr() */
+
+typedef struct memlog {
+  struct memlogentry *e;
+  size_t n,max;
+} memlog;
+
+extern mempool *first_pool;
+extern THREADLOCAL unsigned long num_mallocs;
+extern THREADLOCAL memlog *mem_log;
+
 void *mymalloc(size_t);
 void *mycalloc(size_t);
 void *myrealloc(void *,size_t);
 void myfree(void *);
+void *pool_alloc(mempool *);
+void pool_free(mempool *,void *);
+void log_mem(int,mempool *,void *);
+void commit_mem(memlog *);
+void rollback_mem(memlog *);
+void *pool_carve(mempool *,memchunk *,size_t);
+void print_pool_stats(FILE *);
 
 int field_overflow(int,size_t,taddr);
 taddr bf_sign_extend(taddr,int);
@@ -42,13 +92,19 @@ void conv2ieee64(int,uint8_t *,tfloat);
 int flt_chkrange(tfloat,int);
 #endif
 
+#define FWFILLBUF 0x2000  /* chunk size for fwfill() */
+#define FWSEEKMIN 0x1000  /* fwzeros() seeks over gaps of this size */
+
 void fw8(FILE *,uint8_t);
 void fw16(FILE *,uint16_t,int);
 void fw24(FILE *,uint32_t,int);
 void fw32(FILE *,uint32_t,int);
 void fwdata(FILE *,const void *,size_t);
+void fwfill(FILE *,const uint8_t *,size_t,size_t);
 void fwsblock(FILE *,sblock *);
+int zero_pattern(const uint8_t *,size_t);
 void fwspace(FILE *,size_t);
+void fwzeros(FILE *,size_t);
 void fwalign(FILE *,taddr,taddr);
 int fwalignpattern(FILE *,taddr,uint8_t *,int);
 taddr fwpcalign(FILE *,atom *,section *,taddr);
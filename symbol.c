@@ -4,6 +4,8 @@
 #include "vasm.h"
 
 symbol *first_symbol;
+unsigned long symbol_changes;  /* counts definitions and assignments */
+mempool symbol_pool = MEMPOOL("symbols",sizeof(symbol));
 
 static symbol *saved_symbol;
 static const char *last_global_label=emptystr;
@@ -12,6 +14,7 @@ static const char *last_global_label=emptystr;
 #define SYMHTABSIZE 0x10000
 #endif
 static hashtable *symhash;
+static hashtable *symsnap;  /* read-only copy of symhash, see freeze_symbols */
 
 #ifdef HAVE_REGSYMS
 static hashtable *regsymhash;
@@ -106,6 +109,7 @@ void add_symbol(symbol *p)
 {
   hashdata data;
 
+  symbol_changes++;
   p->next = first_symbol;
   first_symbol = p;
   data.ptr = p;
@@ -116,8 +120,22 @@ void add_symbol(symbol *p)
 symbol *find_symbol(const char *name)
 {
   hashdata data;
+  if (error_trap) {
+    /* worker thread: only the snapshot is safe to read, see fp_eval() */
+    if (symsnap==NULL || !lookup_name(symsnap,name,&data))
+      longjmp(*error_trap,1);  /* new symbol, leave it to the serial pass */
+    return data.ptr;
+  }
+  if (symsnap!=NULL && !inccache_recording) {
+    if (find_name(symsnap,name,&data))
+      return data.ptr;
+    if (symsnap->used == symhash->used)
+      return NULL;  /* no symbols were added after the snapshot */
+  }
   if (!find_name(symhash,name,&data))
-    return 0;
+    data.ptr = NULL;
+  if (inccache_recording)
+    inccache_symprobe(name,data.ptr);
   return data.ptr;
 }
 
@@ -126,11 +144,28 @@ void refer_symbol(symbol *sym,const char *refname)
 /* refer to an existing symbol with an additional name */
 {
   hashdata data;
+  if (inccache_recording)
+    inccache_taint();
   data.ptr=sym;
   add_hashentry(symhash,refname,data);
 }
 
 
+/* Take a snapshot of the symbol table after parsing, and again before
+   worker threads are started when symbols were added in the meantime.
+   Lookups will look there first, and only in symhash for symbols added
+   after it. Removing a symbol drops the snapshot. */
+void freeze_symbols(void)
+{
+  if (symsnap!=NULL && symsnap->used!=symhash->used)
+    symsnap = free_hashtable(symsnap);
+  if (symsnap == NULL) {
+    symsnap = snapshot_hashtable(symhash);
+    name_hashtable(symsnap,"symbols snapshot");
+  }
+}
+
+
 void save_symbols(void)
 /* remember current list of symbols to be restored later */
 {
@@ -156,9 +191,10 @@ void restore_symbols(void)
           lastprot = symp;
       }
       else {
+        symsnap = free_hashtable(symsnap);  /* now stale */
         rem_hashentry(symhash,symp->name,nocase);
         myfree((void *)symp->name);
-        myfree(symp);
+        pool_free(&symbol_pool,symp);
       }
     }
     if (firstprot) {
@@ -235,6 +271,7 @@ symbol *new_abs(const char *name,expr *tree)
   symbol *new = find_symbol(name);
   int add;
 
+  symbol_changes++;
   if (new) {
     if (new->flags&EQUATE)
       general_error(67,name); /* repeatedly defined symbol (error) */
@@ -243,7 +280,7 @@ symbol *new_abs(const char *name,expr *tree)
     add=0;
   }
   else {
-    new = mymalloc(sizeof(*new));
+    new = pool_alloc(&symbol_pool);
     new->name = mystrdup(name);
     add = 1;
   }
@@ -251,6 +288,7 @@ symbol *new_abs(const char *name,expr *tree)
   new->type = EXPRESSION;
   new->sec = 0;
   new->expr = tree;
+  new->cacheid = 0;
 
   if (add) {
     add_symbol(new);
@@ -258,6 +296,8 @@ symbol *new_abs(const char *name,expr *tree)
     new->size = 0;
     new->align = 0;
   }
+  if (inccache_recording)
+    inccache_touch(new);
   return new;
 }
 
@@ -279,8 +319,10 @@ symbol *new_import(const char *name)
 
   if (new)
     return new;
+  if (inccache_recording)
+    inccache_taint();
 
-  new = mymalloc(sizeof(*new));
+  new = pool_alloc(&symbol_pool);
   new->type = IMPORT;
   new->flags = 0;
   new->name = mystrdup(name);
@@ -298,6 +340,9 @@ symbol *new_labsym(section *sec,const char *name)
   symbol *new;
   int add;
 
+  symbol_changes++;
+  if (inccache_recording)
+    inccache_taint();
   if (chklabels) {
     hashdata data;
 
@@ -331,14 +376,14 @@ symbol *new_labsym(section *sec,const char *name)
     else {
       symbol *old = new;
 
-      new = mymalloc(sizeof(*new));
+      new = pool_alloc(&symbol_pool);
       *new = *old;
       general_error(74,name);  /* label redefined (error) */
     }
     add = 0;
   }
   else {
-    new = mymalloc(sizeof(*new));
+    new = pool_alloc(&symbol_pool);
     new->name = mystrdup(name);
     add = 1;
   }
@@ -380,9 +425,12 @@ symbol *internal_abs(const char *name)
 {
   symbol *new = find_symbol(name);
 
+  symbol_changes++;
   if (new) {
     if (new->type!=EXPRESSION || (new->flags&(EXPORT|COMMON|WEAK)))
       general_error(37,name);  /* internal symbol redefined by user */
+    if (inccache_recording)
+      inccache_touch(new);  /* caller may modify it */
   }
   else {
     new = new_abs(name,number_expr(0));
@@ -393,10 +441,14 @@ symbol *internal_abs(const char *name)
 
 expr *set_internal_abs(const char *name,taddr newval)
 {
-  symbol *sym = internal_abs(name);
-  expr *oldexpr = sym->expr;
+  symbol *sym;
+  expr *oldexpr;
   taddr oldval;
 
+  if (error_trap)
+    return NULL;  /* worker thread: the serial pass sets internal symbols */
+  sym = internal_abs(name);
+  oldexpr = sym->expr;
   if (oldexpr == NULL)
     ierror(0);
   eval_expr(oldexpr,&oldval,NULL,0);
@@ -410,7 +462,10 @@ int undef_internal_sym(const char *name,int no_case)
 {
   symbol *sym = internal_abs(name);
 
+  if (inccache_recording)
+    inccache_taint();
   if (sym != NULL && (sym->flags & VASMINTERN)) {
+      symsnap = free_hashtable(symsnap);  /* now stale */
       rem_hashentry(symhash,name,no_case);
       return 1;
   }
@@ -457,6 +512,8 @@ regsym *new_regsym(int redef,int no_case,const char *name,int type,
   int len = strlen(name);
   regsym *rsym;
 
+  if (inccache_recording)
+    inccache_taint();
   /* check if register symbol already exists */
   rsym = no_case!=0 ? find_regsym_nc(name,len) : find_regsym(name,len);
   if (rsym!=NULL && !redef) {
@@ -519,6 +576,8 @@ strsym *find_strsym(char *name,int len)
 {
   hashdata data;
 
+  if (inccache_recording)
+    inccache_taint();  /* string symbols are not cached */
   if (find_namelen(strsymhash,name,len,&data))
     return data.ptr;
   return NULL;
@@ -529,6 +588,7 @@ void *new_strsym(char *name,strbuf *text)
   symbol *sym = find_symbol(name);
   strsym *ssym = find_strsym(name,strlen(name));
 
+  symbol_changes++;
   /* check if string symbol already exists */
   if (ssym!=NULL) {
     general_error(88,name);  /* string symbol redefined */
@@ -554,10 +614,13 @@ void *new_strsym(char *name,strbuf *text)
 int init_symbol(void)
 {
   symhash = new_hashtable(SYMHTABSIZE);
+  name_hashtable(symhash,"symbols");
 #ifdef HAVE_REGSYMS
   regsymhash = new_hashtable(REGSYMHTSIZE);
+  name_hashtable(regsymhash,"regsyms");
 #endif
   strsymhash = new_hashtable(STRSYMHTSIZE);
+  name_hashtable(strsymhash,"strsyms");
   return 1;
 }
 
@@ -49,6 +49,11 @@ struct symbol {
   taddr pc;
   taddr align;
   unsigned long idx; /* usable by output module */
+  /* value cache of EXPRESSION symbols, see eval_expr() */
+  unsigned long cacheid;
+  section *cachesec;
+  taddr cacheval;
+  int cachecnst;
 };
 
 /* type of symbol references */
@@ -73,12 +78,15 @@ struct strsym {
 };
 
 extern symbol *first_symbol;
+extern unsigned long symbol_changes;
+extern mempool symbol_pool;
 
 void print_symbol(FILE *,symbol *);
 const char *get_bind_name(symbol *);
 void add_symbol(symbol *);
 symbol *find_symbol(const char *);
 void refer_symbol(symbol *,const char *);
+void freeze_symbols(void);
 void save_symbols(void);
 void restore_symbols(void);
 
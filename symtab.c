@@ -3,18 +3,107 @@
 
 #include "vasm.h"
 
+/* Slot index of a hash code. Tables grow when three quarters of
+   their slots are used, so probing will always find a free slot. */
+#define HSLOT(ht,h) (((h)^((h)>>16))&((ht)->size-1))
+#define HNEXT(ht,i) (((i)+1)&((ht)->size-1))
+
+hashtable *first_named_hashtable;
+
 hashtable *new_hashtable(size_t size)
 {
   hashtable *new = mymalloc(sizeof(*new));
+  size_t n;
 
 #ifdef LOWMEM
   /* minimal hash tables */
   if (size > 0x100)
     size = 0x100;
 #endif
-  new->size = size;
+  for (n=16; n<size; n<<=1);
+  new->size = n;
+  new->used = 0;
   new->collisions = 0;
-  new->entries = mycalloc(size*sizeof(*new->entries));
+  new->lookups = 0;
+  new->name = NULL;
+  new->nextnamed = NULL;
+  new->entries = mycalloc(n*sizeof(*new->entries));
+  return new;
+}
+
+/* give a table a name and append it to the list reported by -profile */
+void name_hashtable(hashtable *ht,const char *name)
+{
+  hashtable **p;
+
+  for (p=&first_named_hashtable; *p; p=&(*p)->nextnamed);
+  *p = ht;
+  ht->name = name;
+}
+
+/* free a table, also removing it from the -profile list; returns NULL */
+hashtable *free_hashtable(hashtable *ht)
+{
+  hashtable **p;
+
+  if (ht) {
+    for (p=&first_named_hashtable; *p; p=&(*p)->nextnamed) {
+      if (*p == ht) {
+        *p = ht->nextnamed;
+        break;
+      }
+    }
+    myfree(ht->entries);
+    myfree(ht);
+  }
+  return NULL;
+}
+
+/* Insert the used slots of an entry array into a table of empty slots.
+   Starting behind a free slot, every cluster is visited in probing order,
+   so entries of the same name keep their order, see add_hashentry(). */
+static void rehash_entries(hashtable *ht,hashentry *old,size_t oldsize)
+{
+  size_t i,j,k;
+
+  for (k=0; old[k].name; k++);
+  for (i=k+1; i<k+1+oldsize; i++) {
+    hashentry *p = &old[i&(oldsize-1)];
+
+    if (p->name) {
+      for (j=HSLOT(ht,p->hash); ht->entries[j].name; j=HNEXT(ht,j));
+      ht->entries[j] = *p;
+    }
+  }
+}
+
+static void grow_hashtable(hashtable *ht)
+{
+  hashentry *old = ht->entries;
+  size_t oldsize = ht->size;
+
+  ht->size <<= 1;
+  ht->entries = mycalloc(ht->size*sizeof(*ht->entries));
+  rehash_entries(ht,old,oldsize);
+  myfree(old);
+}
+
+/* Make a copy of a table, which uses no more than half of its slots.
+   The copy is meant to be read only, see lookup_name(). */
+hashtable *snapshot_hashtable(hashtable *ht)
+{
+  hashtable *new = mymalloc(sizeof(*new));
+  size_t n;
+
+  for (n=16; n<ht->used*2; n<<=1);
+  new->size = n;
+  new->used = ht->used;
+  new->collisions = 0;
+  new->lookups = 0;
+  new->name = NULL;
+  new->nextnamed = NULL;
+  new->entries = mycalloc(n*sizeof(*new->entries));
+  rehash_entries(new,ht->entries,ht->size);
   return new;
 }
 
@@ -56,37 +145,55 @@ size_t hashcodelen_nc(const char *name,int len)
   return h;
 }
 
-/* add to hashtable; name must be unique */
+/* Add to hashtable. An entry of the same name is shadowed until the new
+   one is removed: entries of one name are kept newest first in probing
+   order, by moving each older one into the slot of the next. */
 void add_hashentry(hashtable *ht,const char *name,hashdata data)
 {
-  size_t i=nocase?(hashcode_nc(name)%ht->size):(hashcode(name)%ht->size);
-  hashentry *new=mymalloc(sizeof(*new));
-  new->name=name;
-  new->data=data;
-  if(debug){
-    if(ht->entries[i])
+  size_t h=nocase?hashcode_nc(name):hashcode(name);
+  size_t i;
+  hashentry *p,new,tmp;
+
+  if(++ht->used>ht->size-(ht->size>>2))
+    grow_hashtable(ht);
+  new.name=name;
+  new.data=data;
+  new.hash=h;
+  for(i=HSLOT(ht,h);(p=&ht->entries[i])->name;i=HNEXT(ht,i)){
+    if(p->hash==h&&
+       (nocase?!stricmp(name,p->name):!strcmp(name,p->name))){
+      tmp=*p;
+      *p=new;
+      new=tmp;
+    }
+    else if(debug||profile)
       ht->collisions++;
   }
-  new->next=ht->entries[i];
-  ht->entries[i]=new;
+  *p=new;
 }
 
-/* remove from hashtable; name must be unique */
+/* remove the newest entry of a name from hashtable */
 void rem_hashentry(hashtable *ht,const char *name,int no_case)
 {
-  size_t i=no_case?(hashcode_nc(name)%ht->size):(hashcode(name)%ht->size);
-  hashentry *p,*last;
+  size_t h=no_case?hashcode_nc(name):hashcode(name);
+  size_t i,j,k;
+  hashentry *p;
 
-  for(p=ht->entries[i],last=NULL;p;p=p->next){
-    if(!strcmp(name,p->name)||(no_case&&!stricmp(name,p->name))){
-      if(last==NULL)
-        ht->entries[i]=p->next;
-      else
-        last->next=p->next;
-      myfree(p);
+  for(i=HSLOT(ht,h);(p=&ht->entries[i])->name;i=HNEXT(ht,i)){
+    if(p->hash==h&&
+       (!strcmp(name,p->name)||(no_case&&!stricmp(name,p->name)))){
+      /* shift following entries of the cluster back into the gap */
+      for(j=HNEXT(ht,i);ht->entries[j].name;j=HNEXT(ht,j)){
+        k=HSLOT(ht,ht->entries[j].hash);
+        if(i<=j?(i<k&&k<=j):(i<k||k<=j))
+          continue;  /* entry is still reachable from its home slot */
+        ht->entries[i]=ht->entries[j];
+        i=j;
+      }
+      ht->entries[i].name=NULL;
+      ht->used--;
       return;
     }
-    last=p;
   }
   ierror(0);
 }
@@ -97,32 +204,56 @@ int find_name(hashtable *ht,const char *name,hashdata *result)
   if(nocase)
     return find_name_nc(ht,name,result);
   else{
-    size_t i=hashcode(name)%ht->size;
+    size_t h=hashcode(name);
+    size_t i;
     hashentry *p;
-    for(p=ht->entries[i];p;p=p->next){
-      if(!strcmp(name,p->name)){
+    if(profile)
+      ht->lookups++;
+    for(i=HSLOT(ht,h);(p=&ht->entries[i])->name;i=HNEXT(ht,i)){
+      if(p->hash==h&&!strcmp(name,p->name)){
         *result=p->data;
         return 1;
-      }else
+      }else if(debug||profile)
         ht->collisions++;
     }
   }
   return 0;
 }
 
+/* Same as find_name(), but the lookup is not counted for -debug or
+   -profile. It doesn't write to the table, so threads may use it
+   concurrently on a table which nobody modifies. */
+int lookup_name(hashtable *ht,const char *name,hashdata *result)
+{
+  size_t h=nocase?hashcode_nc(name):hashcode(name);
+  size_t i;
+  hashentry *p;
+
+  for(i=HSLOT(ht,h);(p=&ht->entries[i])->name;i=HNEXT(ht,i)){
+    if(p->hash==h&&(nocase?!stricmp(name,p->name):!strcmp(name,p->name))){
+      *result=p->data;
+      return 1;
+    }
+  }
+  return 0;
+}
+
 /* same as above, but uses len instead of zero-terminated string */
 int find_namelen(hashtable *ht,const char *name,int len,hashdata *result)
 {
   if(nocase)
     return find_namelen_nc(ht,name,len,result);
   else{
-    size_t i=hashcodelen(name,len)%ht->size;
+    size_t h=hashcodelen(name,len);
+    size_t i;
     hashentry *p;
-    for(p=ht->entries[i];p;p=p->next){
-      if(!strncmp(name,p->name,len)&&p->name[len]==0){
+    if(profile)
+      ht->lookups++;
+    for(i=HSLOT(ht,h);(p=&ht->entries[i])->name;i=HNEXT(ht,i)){
+      if(p->hash==h&&!strncmp(name,p->name,len)&&p->name[len]==0){
         *result=p->data;
         return 1;
-      }else
+      }else if(debug||profile)
         ht->collisions++;
     }
   }
@@ -132,13 +263,16 @@ int find_namelen(hashtable *ht,const char *name,int len,hashdata *result)
 /* finds unique entry in hashtable - case insensitive */
 int find_name_nc(hashtable *ht,const char *name,hashdata *result)
 {
-  size_t i=hashcode_nc(name)%ht->size;
+  size_t h=hashcode_nc(name);
+  size_t i;
   hashentry *p;
-  for(p=ht->entries[i];p;p=p->next){
-    if(!stricmp(name,p->name)){
+  if(profile)
+    ht->lookups++;
+  for(i=HSLOT(ht,h);(p=&ht->entries[i])->name;i=HNEXT(ht,i)){
+    if(p->hash==h&&!stricmp(name,p->name)){
       *result=p->data;
       return 1;
-    }else
+    }else if(debug||profile)
       ht->collisions++;
   }
   return 0;
@@ -147,13 +281,16 @@ int find_name_nc(hashtable *ht,const char *name,hashdata *result)
 /* same as above, but uses len instead of zero-terminated string */
 int find_namelen_nc(hashtable *ht,const char *name,int len,hashdata *result)
 {
-  size_t i=hashcodelen_nc(name,len)%ht->size;
+  size_t h=hashcodelen_nc(name,len);
+  size_t i;
   hashentry *p;
-  for(p=ht->entries[i];p;p=p->next){
-    if(!strnicmp(name,p->name,len)&&p->name[len]==0){
+  if(profile)
+    ht->lookups++;
+  for(i=HSLOT(ht,h);(p=&ht->entries[i])->name;i=HNEXT(ht,i)){
+    if(p->hash==h&&!strnicmp(name,p->name,len)&&p->name[len]==0){
       *result=p->data;
       return 1;
-    }else
+    }else if(debug||profile)
       ht->collisions++;
   }
   return 0;
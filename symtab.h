@@ -8,19 +8,29 @@ typedef union hashdata {
   uint32_t idx;
 } hashdata;
 
+/* open addressing with linear probing, name==NULL marks a free slot */
 typedef struct hashentry {
   const char *name;
   hashdata data;
-  struct hashentry *next;
+  size_t hash;  /* full hash code of name */
 } hashentry;
 
 typedef struct hashtable {
-  hashentry **entries;
-  size_t size;
+  hashentry *entries;
+  size_t size;  /* always a power of two */
+  size_t used;
   int collisions;
+  unsigned long lookups;
+  const char *name;  /* set for tables shown by -profile */
+  struct hashtable *nextnamed;
 } hashtable;
 
+extern hashtable *first_named_hashtable;
+
 hashtable *new_hashtable(size_t);
+hashtable *free_hashtable(hashtable *);
+hashtable *snapshot_hashtable(hashtable *);
+void name_hashtable(hashtable *,const char *);
 size_t hashcode(const char *);
 size_t hashcodelen(const char *,int);
 size_t hashcode_nc(const char *);
@@ -28,6 +38,7 @@ size_t hashcodelen_nc(const char *,int);
 void add_hashentry(hashtable *,const char *,hashdata);
 void rem_hashentry(hashtable *,const char *,int);
 int find_name(hashtable *,const char *,hashdata *);
+int lookup_name(hashtable *,const char *,hashdata *);
 int find_namelen(hashtable *,const char *,int,hashdata *);
 int find_name_nc(hashtable *,const char *,hashdata *);
 int find_namelen_nc(hashtable *,const char *,int,hashdata *);
@@ -2167,8 +2167,14 @@ void parse(void)
     if (parse_end)
       continue;
     s = line;
-    if (!phxass_compat && !devpac_compat)
+    if (!phxass_compat && !devpac_compat) {
+      unsigned long chg = symbol_changes;
+
+      /* __LINE__ is updated on every line, and its value is copied into
+         the expressions using it, so it doesn't count as a change */
       set_internal_abs(line_name,real_line());
+      symbol_changes = chg;
+    }
 
     if (!cond_state()) {
       /* skip source until ELSE or ENDIF */
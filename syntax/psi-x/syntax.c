@@ -1485,6 +1485,26 @@ static int check_directive(char **line)
   return data.idx;
 }
 
+/* directives which only define symbols or depend on them, allowed
+   in include files to be cached */
+static int cacheable_directive(int idx)
+{
+  static void (*funcs[])(char *) = {
+    handle_rsset,handle_rsreset,handle_rseven,
+    handle_rs8,handle_rs16,handle_rs32,
+    handle_ifne,handle_else,handle_elseif,handle_endif,
+    handle_ifb,handle_ifnb,handle_ifc,handle_ifnc,handle_ifd,handle_ifnd,
+    handle_ifeq,handle_ifgt,handle_ifge,handle_iflt,handle_ifle
+  };
+  size_t i;
+
+  for (i=0; i<sizeof(funcs)/sizeof(funcs[0]); i++) {
+    if (directives[idx].func == funcs[i])
+      return 1;
+  }
+  return 0;
+}
+
 /* Handles assembly directives; returns non-zero if the line
    was a directive. */
 static int handle_directive(char *line)
@@ -1492,6 +1512,8 @@ static int handle_directive(char *line)
   int idx = check_directive(&line);
 
   if (idx >= 0) {
+    if (inccache_recording && !cacheable_directive(idx))
+      inccache_taint();
     directives[idx].func(skip(line));
     return 1;
   }
@@ -1801,6 +1823,8 @@ void parse(void)
         s = line;
         if (!(buf = parse_identifier(0,&s)))
           ierror(0);
+        if (inccache_recording)
+          inccache_taint();
         if (new_structure(buf->str))
           current_section->flags |= LABELS_ARE_LOCAL;
         continue;
@@ -1831,7 +1855,15 @@ void parse(void)
 
     s = handle_iif(s);
 
-    s = parse_cpu_special(s);
+    if (inccache_recording) {
+      char *start = s;
+
+      s = parse_cpu_special(s);
+      if (s != start)
+        inccache_taint();  /* cpu specific state may have changed */
+    }
+    else
+      s = parse_cpu_special(s);
     if (ISEOL(s))
       continue;
 
@@ -1918,6 +1950,12 @@ void parse(void)
   cond_check();  /* check for open conditional blocks */
 }
 
+/* include files cannot be cached while PUBLIC ON exports new symbols */
+int my_inccache_safe(void)
+{
+  return !public_status;
+}
+
 /* src is the new macro source, cur_src is still the parent source */
 void my_exec_macro(source *src)
 {
@@ -1998,7 +2036,7 @@ static int macro_arg_defined(source *src,char *argstart,char *argend,char *d,int
 /* expands arguments and special escape codes into macro context */
 int expand_macro(source *src,char **line,char *d,int dlen)
 {
-  symbol *shift = internal_abs(CARGSYM);
+  symbol *shift;
   int nc = 0;
   int n;
   char *s = *line;
@@ -2006,6 +2044,7 @@ int expand_macro(source *src,char **line,char *d,int dlen)
 
   if (*s++ == '\\') {
     /* possible macro expansion detected */
+    shift = internal_abs(CARGSYM);
 
     if (*s == '\\') {
       if (dlen >= 1) {
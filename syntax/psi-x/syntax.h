@@ -36,4 +36,11 @@ char *exp_skip(char *);
 char *my_skip_macro_arg(char *);
 #define SKIP_MACRO_ARGNAME(p) my_skip_macro_arg(p)
 void my_exec_macro(source *);
-#define EXEC_MACRO(s) my_exec_macro(s)
\ No newline at end of file
+#define EXEC_MACRO(s) my_exec_macro(s)
+
+/* characters which may start an expansion in a macro body or source line */
+#define MACRO_SPECIAL(c) ((c)=='\\'||(c)=='{')
+
+/* include files may be replayed from the include cache */
+int my_inccache_safe(void);
+#define INCCACHE_SAFE my_inccache_safe()
\ No newline at end of file
@@ -0,0 +1,14 @@
+; Every job of a batch starts from the same state, so it must create the
+; same output as a separate run with its -D options.
+	section	code
+	ifd	VARIANT
+	rept	VARIANT+1
+	moveq	#VARIANT,d0
+	endr
+	endc
+	ifnd	VARIANT
+	nop
+	endc
+loop:
+	bra	loop
+	dc.w	*-loop
@@ -0,0 +1,23 @@
+; Runs of data definitions are coalesced into one atom, which must give
+; the same output as the single atoms written with a listing file.
+	section	code
+start:
+	dc.b	1,2,3
+	dc.w	$1234
+	dc.b	"text",0
+	even
+	dc.l	$deadbeef,start
+	dc.l	$01020304
+	cnop	0,4
+	rept	100
+	dc.b	REPTN
+	dc.w	REPTN*3
+	endr
+label:
+	dc.w	label-start
+	dcb.b	5,$ff
+	dc.b	6
+	ds.b	3
+	dc.b	7,8
+	align	3
+	dc.b	9
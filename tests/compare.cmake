@@ -0,0 +1,16 @@
+# Assemble SRC and REF with VASM and OPTS, then compare the outputs.
+separate_arguments(opts UNIX_COMMAND "${OPTS}")
+foreach(f SRC REF)
+  execute_process(
+    COMMAND ${VASM} -quiet ${opts} -Fbin -o ${OUT}.${f}.bin ${${f}}
+    RESULT_VARIABLE rc)
+  if(NOT rc EQUAL 0)
+    message(FATAL_ERROR "assembling ${${f}} failed")
+  endif()
+endforeach()
+execute_process(
+  COMMAND ${CMAKE_COMMAND} -E compare_files ${OUT}.SRC.bin ${OUT}.REF.bin
+  RESULT_VARIABLE rc)
+if(NOT rc EQUAL 0)
+  message(FATAL_ERROR "output of ${SRC} differs from ${REF}")
+endif()
@@ -0,0 +1,33 @@
+# Assemble SRC as one job per -D option in DEFS from a -batch file, then
+# with a separate run for each of them, and compare the outputs.
+separate_arguments(defs UNIX_COMMAND "${DEFS}")
+set(n 0)
+set(jobs "")
+foreach(d ${defs})
+  string(APPEND jobs "${SRC} ${OUT}.job${n}.bin ${d}\n")
+  math(EXPR n "${n}+1")
+endforeach()
+file(WRITE ${OUT}.batch "${jobs}")
+execute_process(
+  COMMAND ${VASM} -quiet -Fbin -jobs=2 -batch=${OUT}.batch
+  RESULT_VARIABLE rc)
+if(NOT rc EQUAL 0)
+  message(FATAL_ERROR "batch ${OUT}.batch failed")
+endif()
+set(n 0)
+foreach(d ${defs})
+  execute_process(
+    COMMAND ${VASM} -quiet -Fbin ${d} -o ${OUT}.run${n}.bin ${SRC}
+    RESULT_VARIABLE rc)
+  if(NOT rc EQUAL 0)
+    message(FATAL_ERROR "assembling ${SRC} with ${d} failed")
+  endif()
+  execute_process(
+    COMMAND ${CMAKE_COMMAND} -E compare_files ${OUT}.job${n}.bin
+                                              ${OUT}.run${n}.bin
+    RESULT_VARIABLE rc)
+  if(NOT rc EQUAL 0)
+    message(FATAL_ERROR "batch job with ${d} differs from a single run")
+  endif()
+  math(EXPR n "${n}+1")
+endforeach()
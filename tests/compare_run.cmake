@@ -0,0 +1,23 @@
+# Assemble SRC with VASM and PLAIN options, then with OPTS, and compare
+# the outputs. With TWICE, the second run is repeated first, e.g. to
+# write a file which is read by the compared run.
+separate_arguments(plain UNIX_COMMAND "${PLAIN}")
+separate_arguments(opts UNIX_COMMAND "${OPTS}")
+set(runs plain opts)
+if(TWICE)
+  set(runs plain opts opts)
+endif()
+foreach(r ${runs})
+  execute_process(
+    COMMAND ${VASM} -quiet ${${r}} -Fbin -o ${OUT}.${r}.bin ${SRC}
+    RESULT_VARIABLE rc)
+  if(NOT rc EQUAL 0)
+    message(FATAL_ERROR "assembling ${SRC} with ${${r}} failed")
+  endif()
+endforeach()
+execute_process(
+  COMMAND ${CMAKE_COMMAND} -E compare_files ${OUT}.plain.bin ${OUT}.opts.bin
+  RESULT_VARIABLE rc)
+if(NOT rc EQUAL 0)
+  message(FATAL_ERROR "output of ${SRC} with ${OPTS} differs")
+endif()
@@ -0,0 +1,8 @@
+; defines VAL and a macro from BASE, and FLAG when BASE is large
+VAL	set	BASE*2+1
+	ifgt	BASE-3
+FLAG	set	1
+	endc
+putval	macro
+	dc.w	VAL+\1
+	endm
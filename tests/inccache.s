@@ -0,0 +1,15 @@
+; The include cache must replay an include file once for every state of
+; the outside symbols it refers to, and parse it again otherwise.
+FLAG	set	0
+BASE	set	1
+	include	"inccache.i"
+	putval	0
+	dc.w	FLAG
+BASE	set	5
+	include	"inccache.i"
+	putval	1
+	dc.w	FLAG
+BASE	set	1
+	include	"inccache.i"
+	putval	2
+	dc.w	FLAG
@@ -0,0 +1,25 @@
+; A build seeded from a -layout file must create the same output as a
+; build without it. The branches of the first section need several passes
+; to shrink without the file, and only one with it.
+step	macro
+l\@:	bne	n\@
+	bsr	sub
+	lea	(l\@,pc),a0
+	jmp	sub
+	dcb.b	\1,0
+n\@:
+	endm
+
+	org	$1000
+sub:
+	rept	30
+	step	40
+	step	100
+	endr
+	rts
+	org	$4000
+dat:
+	rept	20
+	step	130
+	endr
+	dc.l	sub,dat
@@ -0,0 +1 @@
+	dc.w	3,2,1
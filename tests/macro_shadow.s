@@ -0,0 +1,16 @@
+; A redefined macro shadows the old definition, which is used again
+; after .macundef removed the new one.
+	.macro	val
+	dc.w	1
+	.endm
+	.macro	val
+	dc.w	2
+	.endm
+	.macro	val
+	dc.w	3
+	.endm
+	val
+	.macundef val
+	val
+	.macundef val
+	val
@@ -0,0 +1,2 @@
+	section	code
+	dc.w	$4e71,$4e71,$4e75,$4e75
@@ -0,0 +1,10 @@
+; A repeat-block reading REPTN in a conditional is not invariant,
+; although its first two iterations create the same code.
+	section	code
+	rept	4
+	iflt	REPTN-2
+	nop
+	else
+	rts
+	endc
+	endr
@@ -0,0 +1,13 @@
+; The final pass with worker threads must create the same output as the
+; serial pass, also for the atoms which the workers leave to it.
+	section	code
+start:
+	rept	600
+	move.l	data(pc),d0
+	bne	start
+	dc.w	*-start
+	lea	data,a0
+	endr
+	movem.l	d0-d7,-(sp)
+	moveq	#_MOVEMBYTES,d0
+data:	dc.l	start,data
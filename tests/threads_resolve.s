@@ -0,0 +1,34 @@
+; Worker threads resolve the ORG sections at the same time. The output
+; must be the same as with the serial resolver, also when a section reads
+; labels of a section which is resolved at the same time.
+	org	$1000
+a:
+	rept	400
+	bne	a_end
+	move.w	c_end,d0
+	endr
+a_end:	rts
+
+	org	$3000
+b:
+	rept	400
+	bra	b
+	dc.w	*-b
+	endr
+b_end:	rts
+
+	org	$5000
+c:
+	rept	400
+	beq	c_end
+	lea	a_end,a1
+	endr
+c_end:	rts
+
+	org	$7000
+d:
+	rept	400
+	bsr	d_end
+	move.l	b_end,d1
+	endr
+d_end:	rts
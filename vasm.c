@@ -21,19 +21,45 @@ static const char *_ver = "$VER: " _VER " " __AMIGADATE__ "\r\n";
    which will hopefully never happen.
    During the first FASTOPTPHASE passes all instructions of a section are
    optimized at the same time. Thereafter the resolver enters a safe mode,
-   where only a single instruction is changed in every pass. */
+   where only a single instruction is changed in every pass.
+   With -pinosc, atoms which reverse the direction of their size changes
+   OSCREVERSALS times are considered oscillating. They are pinned by
+   treating them like atoms which exceeded MAXSIZECHANGES, so they can no
+   longer shrink, which usually stops the oscillation long before the safe
+   mode is needed. But a pinned atom may keep a larger size than the safe
+   mode would have found.
+   With -incresolve all passes after the first one during the fast phase
+   will only re-size atoms whose referenced labels moved relative to them.
+   Such an incremental result is verified by a normal pass, and a failed
+   verification falls back to normal passes for the rest of the section.
+   A section is resolved again when a section it refers to needed more
+   than one pass. With -depresolve only moved labels cause this, and a
+   section waits until all the sections it refers to are resolved, unless
+   they depend on each other.
+   With -threads, worker threads resolve sections which don't refer to
+   each other at the same time (see resolve_round()). */
 #define MAXPASSES 1500
 #define FASTOPTPHASE 200
+#define OSCREVERSALS 2
+#define MAXRDEPS 4   /* max. number of labels recorded per atom */
+
+/* The output file gets a buffer for the whole image, up to OUTBUFMAX bytes,
+   so most objects are written at once when the file is closed. */
+#define OUTBUFMAX 0x400000
+#define OUTBUFSLACK 0x10000  /* for headers, relocations and symbols */
+
+#define BATCHLINELEN 4096  /* max. length of a -daemon request */
 
 /* global options */
 char *output_format="test";
 char *inname,*outname;
-int chklabels,nocase,no_symbols,pic_check,unnamed_sections;
+int chklabels,nocase,no_symbols,unnamed_sections;
+THREADLOCAL int pic_check;  /* set by cpu options */
 unsigned space_init;
 taddr inst_alignment;
 
 /* global module options */
-int asciiout,secname_attr,warn_unalloc_ini_dat;
+int asciiout,secname_attr,warn_unalloc_ini_dat,no_coalesce;
 
 /* MNEMOHTABSIZE should be defined by cpu module */
 #ifndef MNEMOHTABSIZE
@@ -42,10 +68,10 @@ int asciiout,secname_attr,warn_unalloc_ini_dat;
 hashtable *mnemohash;
 
 char *filename,*debug_filename;
-source *cur_src;
+THREADLOCAL source *cur_src;
 section *current_section,container_section;
 int num_secs;
-int debug,final_pass,exec_out,nostdout;
+int debug,profile,final_pass,exec_out,nostdout;
 char *defsectname,*defsecttype;
 taddr defsectorg;
 
@@ -59,7 +85,10 @@ char emptystr[]="";
 char vasmsym_name[]="__VASM";
 
 static FILE *outfile;
+static FILE *job_objfile,*job_report;  /* set for -daemon jobs */
+static char *outbuf;
 static int maxpasses=MAXPASSES;
+static int incresolve,depresolve,pinosc,memstats,exprcode;
 static section *first_section,*last_section;
 #if NOT_NEEDED
 static section *prev_sec,*prev_org;
@@ -72,6 +101,9 @@ static int secstack_index;
 
 /* options */
 static char *listname,*dep_filename;
+static char *batch_filename,*layout_name;
+static int batch_jobs=1,daemon_mode;
+static int threads=1;
 static int dwarf,fail_on_warning;
 static int verbose=1,auto_import=1;
 static taddr sec_padding;
@@ -81,6 +113,31 @@ static char *output_copyright;
 static void (*write_object)(FILE *,section *,symbol *);
 static int (*output_args)(char *);
 
+/* -profile */
+enum {
+  PROF_PARSE,PROF_RESOLVE,PROF_ASSEMBLE,PROF_LISTING,PROF_OUTPUT,PROF_PHASES
+};
+static const char *prof_phasename[PROF_PHASES] = {
+  "parse","resolve","assemble","listing","output"
+};
+static const char *prof_atomname[NLIST+1] = {
+  "vasmdebug","label","data","instruction","space","datadef","line",
+  "opts","printtext","printexpr","roffs","rorg","rorgend","assert","nlist"
+};
+struct secprof {
+  clock_t time;
+  int resolves;
+  int passes;
+  unsigned pinned;
+};
+static char *prof_filename;
+static clock_t prof_time[PROF_PHASES],prof_start;
+static unsigned long prof_atoms[NLIST+1];
+static struct secprof *prof_sec;
+static int prof_nsecs;
+
+static void print_profile(void);
+
 
 void leave(void)
 {
@@ -89,8 +146,13 @@ void leave(void)
 
   if(outfile){
     fclose(outfile);
-    if (errors&&outname!=NULL)
+    if (errors&&outname!=NULL&&outfile!=job_objfile)
       remove(outname);
+    myfree(outbuf);
+  }
+  if(job_report){
+    report_sources(job_report);  /* to be kept in memory by the daemon */
+    fclose(job_report);
   }
 
   if(debug){
@@ -105,8 +167,14 @@ void leave(void)
     }
   }
 
+  if(profile)
+    print_profile();
+
   exit_symbol();
 
+  if(memstats)
+    print_pool_stats(stdout);
+
   if(errors||(fail_on_warning&&warnings))
     exit(EXIT_FAILURE);
   else
@@ -253,15 +321,100 @@ void vasmdebug(const char *f,section *s,atom *a)
   }
 }
 
-static int resolve_section(section *sec)
+/* label references of an atom, recorded when it was sized last */
+struct rdep {
+  taddr pc;           /* atom's pc during atom_size() */
+  int nsyms;          /* number of labels, RDEP_DIRTY: has to be re-sized */
+  symbol *sym[MAXRDEPS];
+  taddr val[MAXRDEPS];  /* label distance in the same section, else value */
+};
+#define RDEP_DIRTY -1
+
+/* size change history of an atom during resolve_section() */
+#define OSC_GREW 1
+#define OSC_SHRUNK 2
+#define OSC_REV 4  /* added for each reversal of direction */
+
+static THREADLOCAL struct rdep *cur_rdep;
+static THREADLOCAL section *rdep_sec;
+static bvtype *resbusy;  /* sections resolved by worker threads */
+
+static taddr rdep_value(symbol *sym,taddr pc)
+{
+  if(sym->sec==rdep_sec&&!(rdep_sec->flags&ABSOLUTE))
+    return sym->pc-pc;
+  return sym->pc;
+}
+
+/* called by eval_expr() and find_base() for every referenced label */
+static void rdep_symref(symbol *sym)
+{
+  struct rdep *r=cur_rdep;
+  int i;
+
+  if(resbusy!=NULL&&sym!=NULL&&sym->sec!=NULL&&sym->sec!=rdep_sec&&
+     BTST(resbusy,sym->sec->idx)){
+    /* worker thread: the label moves while another worker resolves its
+       section, so this section waits for it (see resolve_round()) */
+    BSET(res_refs,sym->sec->idx);
+    longjmp(*error_trap,1);
+  }
+  if(r==NULL||r->nsyms==RDEP_DIRTY)
+    return;
+  if(sym==NULL){
+    r->nsyms=RDEP_DIRTY;  /* depends on the current pc */
+    return;
+  }
+  for(i=0;i<r->nsyms;i++){
+    if(r->sym[i]==sym)
+      return;
+  }
+  if(r->nsyms>=MAXRDEPS){
+    r->nsyms=RDEP_DIRTY;
+    return;
+  }
+  r->sym[r->nsyms]=sym;
+  r->val[r->nsyms++]=rdep_value(sym,r->pc);
+}
+
+/* check whether an atom would get the same size as in the previous pass */
+static int rdep_unchanged(struct rdep *r,section *sec)
+{
+  int i;
+
+  if(r->nsyms==RDEP_DIRTY)
+    return 0;
+  if((sec->flags&ABSOLUTE)&&r->pc!=sec->pc)
+    return 0;
+  for(i=0;i<r->nsyms;i++){
+    if(r->val[i]!=rdep_value(r->sym[i],sec->pc))
+      return 0;
+  }
+  return 1;
+}
+
+static int resolve_section(section *sec,unsigned *pinned,int *moved)
 {
   taddr rorg_pc,org_pc;
   int fastphase=FASTOPTPHASE;
   int pass=0;
-  int done,extrapass,rorg;
-  size_t size;
+  int done,extrapass,rorg,incpass,verify;
+  size_t size,i;
+  struct rdep *rdeps=NULL;
+  unsigned char *osc;
   atom *p;
 
+  for(i=0,p=sec->first;p;p=p->next)
+    i++;
+  osc=pinosc&&i?mycalloc(i):NULL;
+  if(incresolve&&i)
+    rdeps=mymalloc(i*sizeof(struct rdep));
+  if(incresolve||error_trap){
+    rdep_sec=sec;
+    record_symref=rdep_symref;
+  }
+  verify=0;
+
   do{
     done=1;
     rorg=0;
@@ -270,14 +423,15 @@ static int resolve_section(section *sec)
       break;
     }
     extrapass=pass<=fastphase;
+    incpass=rdeps!=NULL&&pass>1&&pass<=fastphase&&!verify;
     if(debug)
       printf("resolve_section(%s) pass %d%s",sec->name,pass,
-             pass<=fastphase?" (fast)\n":"\n");
+             incpass?" (incremental)\n":(pass<=fastphase?" (fast)\n":"\n"));
     sec->pc=sec->org;
-    for(p=sec->first;p;p=p->next){
+    for(p=sec->first,i=0;p;p=p->next,i++){
       sec->pc=pcalign(p,sec->pc);
-      if(cur_src=p->src)
-        cur_src->line=p->line;
+      if((cur_src=p->src)&&!error_trap)
+        cur_src->line=p->line;  /* shared, and workers report no messages */
 #if HAVE_CPU_OPTS
       if(p->type==OPTS){
         cpu_opts(p->content.opts);
@@ -287,7 +441,7 @@ static int resolve_section(section *sec)
       if(p->type==RORG){
         if(rorg)
           general_error(43);  /* reloc org is already set */
-        rorg_pc=*p->content.rorg;
+        rorg_pc=p->content.rorg;
         org_pc=sec->pc;
         sec->pc=rorg_pc;
         sec->flags|=ABSOLUTE;
@@ -310,15 +464,34 @@ static int resolve_section(section *sec)
                    (unsigned long)label->pc,(unsigned long)sec->pc);
           done=0;
           label->pc=sec->pc;
+          if(symval_epoch)  /* zero while worker threads resolve */
+            symval_epoch++;
+          *moved=1;
         }
       }
-      else if(p->type==VASMDEBUG)
+      else if(p->type==VASMDEBUG){
+        if(error_trap)
+          longjmp(*error_trap,1);  /* its output is left to the serial pass */
         vasmdebug("resolve_section",sec,p);
+      }
       if(pass>fastphase&&!done&&p->type==INSTRUCTION){
         /* entered safe mode: optimize only one instruction every pass */
         sec->pc+=p->lastsize;
         continue;
       }
+      if(rdeps!=NULL&&
+         (p->type==INSTRUCTION||p->type==DATADEF||p->type==SPACE)){
+        if(incpass&&p->changes<=MAXSIZECHANGES&&
+           rdep_unchanged(&rdeps[i],sec)){
+          sec->pc+=p->lastsize;
+          continue;
+        }
+        cur_rdep=&rdeps[i];
+        cur_rdep->pc=sec->pc;
+        cur_rdep->nsyms=0;
+      }
+      else
+        cur_rdep=NULL;
       if(p->changes>MAXSIZECHANGES){
         /* atom changed size too frequently, set warning flag */
         if(debug)
@@ -330,20 +503,43 @@ static int resolve_section(section *sec)
       }
       else
         size=atom_size(p,sec,sec->pc);
+      if(osc&&size!=p->lastsize&&p->changes<=MAXSIZECHANGES){
+        int dir=size>p->lastsize?OSC_GREW:OSC_SHRUNK;
+
+        if(osc[i]&(OSC_GREW|OSC_SHRUNK)&~dir)
+          osc[i]+=OSC_REV;
+        osc[i]=(osc[i]&~(OSC_GREW|OSC_SHRUNK))|dir;
+        if(osc[i]/OSC_REV>=OSCREVERSALS){
+          /* oscillating atom: pin it, so it may only grow from now on */
+          if(debug)
+            printf("pinning oscillating atom type %d at line %d (0x%lx)\n",
+                   p->type,p->line,(unsigned long)sec->pc);
+          p->changes=MAXSIZECHANGES+1;
+          (*pinned)++;
+          sec->flags|=RESOLVE_WARN;
+          size=atom_size(p,sec,sec->pc);
+          sec->flags&=~RESOLVE_WARN;
+        }
+      }
       if(size!=p->lastsize){
         if(debug)
           printf("modify size of atom type %d at line %d (0x%lx) from "
                  "%lu to %lu\n",p->type,p->line,(unsigned long)sec->pc,
                  (unsigned long)p->lastsize,(unsigned long)size);
         done=0;
-        if(pass>fastphase)
-          p->changes++;  /* now count size modifications of atoms */
+        if(pass>fastphase){
+          if(p->changes<=MAXSIZECHANGES)
+            p->changes++;  /* now count size modifications of atoms */
+        }
         else if(size>p->lastsize)
           extrapass=0;   /* no extra pass, when an atom became larger */
         p->lastsize=size;
+        if(cur_rdep)
+          cur_rdep->nsyms=RDEP_DIRTY;  /* size may depend on lastsize */
       }
       sec->pc+=size;
     }
+    cur_rdep=NULL;
     if(rorg){
       sec->pc=org_pc+(sec->pc-rorg_pc);
       sec->flags&=~ABSOLUTE;  /* workaround for missing RORGEND */
@@ -351,7 +547,27 @@ static int resolve_section(section *sec)
     /* Extend the fast-optimization phase, when there was no atom which
        became larger than in the previous pass. */
     if(extrapass) fastphase++;
+    if(rdeps!=NULL){
+      if(verify){
+        if(!done){
+          /* verification failed: fall back to normal passes */
+          if(debug)
+            printf("resolve_section(%s): incremental verification failed\n",
+                   sec->name);
+          myfree(rdeps);
+          rdeps=NULL;
+        }
+      }
+      else if(incpass&&done){
+        done=0;
+        verify=1;  /* verify the result with a normal pass */
+      }
+    }
   }while(errors==0&&!done);
+
+  record_symref=NULL;
+  myfree(rdeps);
+  myfree(osc);
   return pass;
 }
 
@@ -362,11 +578,457 @@ static void bvunite(bvtype *dest,bvtype *src,size_t len)
     *dest++|=*src++;
 }
 
+/* check whether sec refers to another section which is still to do */
+static int resolve_waits(section *sec,bvtype *todo)
+{
+  section *s;
+
+  for(s=first_section;s;s=s->next){
+    if(s!=sec&&BTST(todo,s->idx)&&s->deps&&BTST(s->deps,sec->idx))
+      return 1;
+  }
+  return 0;
+}
+
+/* bookkeeping after sec was resolved, which took time t */
+static void resolved_section(section *sec,bvtype *todo,int passes,int moved,
+                             unsigned pinned,clock_t t)
+{
+  if(profile){
+    prof_sec[sec->idx].time+=t;
+    prof_sec[sec->idx].resolves++;
+    prof_sec[sec->idx].passes+=passes;
+    prof_sec[sec->idx].pinned+=pinned;
+  }
+  BCLR(todo,sec->idx);
+  if(depresolve?moved:passes>1){
+    if(sec->deps)
+      bvunite(todo,sec->deps,BVSIZE(num_secs));
+  }
+}
+
+/* Worker threads have their own cpu options, so they may only work on
+   sections which start with all of them (see cpu_opts_init()). */
+static int own_cpu_opts(section *sec)
+{
+#if HAVE_CPU_OPTS
+  return sec->first!=NULL&&sec->first->type==OPTS;
+#else
+  return 1;
+#endif
+}
+
+static unsigned long thread_mallocs;  /* allocations by worker threads */
+
+/* called by every worker thread n before it returns */
+static void leave_worker(int n)
+{
+  reset_eval(n!=0);
+  if(n!=0){
+    lock_threads();
+    thread_mallocs+=num_mallocs;
+    unlock_threads();
+  }
+}
+
+/* Resolving with worker threads (-threads): a round takes all sections
+   in todo which don't wait for another one, and which set all cpu options
+   for themselves, and the workers resolve them at the same time. A worker
+   gives up its section when it needs anything shared (see error_trap),
+   or reads a label of another section of the round, which may still move.
+   The section is restored, and resolved by the serial loop after the
+   round. Dependencies found by the workers are added to the sections
+   after the round, and sections are queued again as by the serial loop.
+   Rounds visit the sections in a different order than the serial loop,
+   but every section is resolved with final labels of the sections it
+   refers to, unless they refer to each other. */
+struct resjob {
+  section *sec;
+  bvtype *refs;  /* sections referred to, see res_refs */
+  int passes,moved,trapped;
+  unsigned pinned;
+  memlog mem;
+};
+static struct resjob *resjobs;
+static size_t resnjobs,restaken;
+
+/* what resolve_section() modifies in a section, to restore it */
+struct atomsave {
+  size_t lastsize;
+  union {
+    taddr pc;      /* LABEL */
+    size_t space;  /* SPACE */
+  } v;
+  unsigned char changes;
+};
+struct secsave {
+  taddr pc;
+  uint32_t flags;
+  struct atomsave *atoms;
+  instruction *insts;
+};
+
+static void save_section(section *sec,struct secsave *sv)
+{
+  atom *p;
+  size_t n,ni;
+
+  for(n=ni=0,p=sec->first;p;p=p->next,n++){
+    if(p->type==INSTRUCTION)
+      ni++;
+  }
+  sv->pc=sec->pc;
+  sv->flags=sec->flags;
+  sv->atoms=n?mymalloc(n*sizeof(struct atomsave)):NULL;
+  sv->insts=ni?mymalloc(ni*sizeof(instruction)):NULL;
+  for(n=ni=0,p=sec->first;p;p=p->next,n++){
+    sv->atoms[n].lastsize=p->lastsize;
+    sv->atoms[n].changes=p->changes;
+    if(p->type==LABEL)
+      sv->atoms[n].v.pc=p->content.label->pc;
+    else if(p->type==SPACE)
+      sv->atoms[n].v.space=p->content.sb->space;
+    else if(p->type==INSTRUCTION)
+      sv->insts[ni++]=*p->content.inst;
+  }
+}
+
+static void restore_section(section *sec,struct secsave *sv)
+{
+  atom *p;
+  size_t n,ni;
+
+  sec->pc=sv->pc;
+  sec->flags=sv->flags;
+  for(n=ni=0,p=sec->first;p;p=p->next,n++){
+    p->lastsize=sv->atoms[n].lastsize;
+    p->changes=sv->atoms[n].changes;
+    if(p->type==LABEL)
+      p->content.label->pc=sv->atoms[n].v.pc;
+    else if(p->type==SPACE)
+      p->content.sb->space=sv->atoms[n].v.space;
+    else if(p->type==INSTRUCTION)
+      *p->content.inst=sv->insts[ni++];
+  }
+}
+
+static void res_job(struct resjob *j)
+{
+  jmp_buf trap;
+  struct secsave sv;
+
+  save_section(j->sec,&sv);
+  if(setjmp(trap)){
+    error_trap=NULL;
+    mem_log=NULL;
+    res_refs=NULL;
+    record_symref=NULL;
+    cur_rdep=NULL;
+    rollback_mem(&j->mem);
+    reset_eval(0);
+    restore_section(j->sec,&sv);
+    j->trapped=1;  /* left to the serial loop */
+  }
+  else{
+    error_trap=&trap;
+    mem_log=&j->mem;
+    res_refs=j->refs;
+    j->passes=resolve_section(j->sec,&j->pinned,&j->moved);
+    error_trap=NULL;
+    mem_log=NULL;
+    res_refs=NULL;
+  }
+  myfree(sv.atoms);
+  myfree(sv.insts);
+}
+
+static void res_worker(int n)
+{
+  size_t i;
+
+  for(;;){
+    lock_threads();
+    i=restaken++;
+    unlock_threads();
+    if(i>=resnjobs)
+      break;
+    res_job(&resjobs[i]);
+  }
+  leave_worker(n);
+}
+
+/* a section which may be resolved in a round */
+static int round_section(section *sec,bvtype *todo)
+{
+  return BTST(todo,sec->idx)&&!resolve_waits(sec,todo)&&own_cpu_opts(sec);
+}
+
+/* resolve a round of sections, returns their number, or 0 when there
+   were not enough of them */
+static size_t resolve_round(bvtype *todo)
+{
+  unsigned long epoch=symval_epoch;
+  struct resjob *j;
+  section *sec,*s;
+  size_t i,n;
+  clock_t t0;
+
+  for(n=0,sec=first_section;sec;sec=sec->next){
+    if(round_section(sec,todo))
+      n++;
+  }
+  if(n<2)
+    return 0;
+  resjobs=mycalloc(n*sizeof(struct resjob));
+  resbusy=mycalloc(BVSIZE(num_secs));
+  for(i=0,sec=first_section;sec;sec=sec->next){
+    if(round_section(sec,todo)){
+      resjobs[i].sec=sec;
+      resjobs[i++].refs=mycalloc(BVSIZE(num_secs));
+      BSET(resbusy,sec->idx);
+    }
+  }
+  resnjobs=n;
+  restaken=0;
+  symval_epoch=0;  /* workers don't use the value cache of shared symbols */
+  if(!run_threads(threads,res_worker)){
+    threads=1;
+    n=0;
+  }
+  symval_epoch=epoch+1;  /* labels have moved */
+  num_mallocs+=thread_mallocs;
+  thread_mallocs=0;
+  myfree(resbusy);
+  resbusy=NULL;
+
+  for(i=0;i<resnjobs;i++){
+    j=&resjobs[i];
+    for(s=first_section;s;s=s->next){
+      if(BTST(j->refs,s->idx)&&s!=j->sec){
+        if(!s->deps){
+          s->deps=mymalloc(BVSIZE(num_secs));
+          memset(s->deps,0,BVSIZE(num_secs));
+        }
+        BSET(s->deps,j->sec->idx);
+      }
+    }
+    myfree(j->refs);
+    if(n==0)
+      continue;
+    if(j->trapped){
+      t0=profile?clock():0;
+      j->passes=resolve_section(j->sec,&j->pinned,&j->moved);
+      resolved_section(j->sec,todo,j->passes,j->moved,j->pinned,
+                       profile?clock()-t0:0);
+    }
+    else{
+      commit_mem(&j->mem);  /* no time, it was shared with other sections */
+      resolved_section(j->sec,todo,j->passes,j->moved,j->pinned,0);
+    }
+  }
+  myfree(resjobs);
+  resjobs=NULL;
+  return n;
+}
+
+/* Warm start of the resolver (-layout): the final sizes of all atoms and
+   the addresses of all labels are saved after resolving. The next build
+   starts with these values, so unchanged parts of a section converge in
+   the first pass. A run of atoms is identified by the label in front of
+   it, and the saved sizes are used while the atom types still match.
+   Sections which needed pinned atoms to converge are saved without a
+   layout, as the result of their cold resolve depends on the history of
+   the passes and would not be reproduced by a warm start. */
+#define LAYOUTMAGIC "vasm layout 1"
+
+struct layrun {
+  struct layrun *next;  /* next run in the file */
+  char *name;    /* label in front of the run */
+  taddr pc;      /* address of the label */
+  char *atoms;   /* first atom line in the loaded file */
+  size_t n;      /* number of atom lines */
+};
+
+struct laysec {
+  struct laysec *next;
+  char *name;
+  struct layrun start;  /* atoms in front of the first label */
+  struct layrun *last;
+  size_t nruns;
+  hashtable *runs;      /* runs by label name, made on the first miss */
+};
+
+static void save_layout(void)
+{
+  char buf[32],*d;
+  section *sec;
+  atom *p;
+  FILE *f;
+
+  if(!(f=fopen(layout_name,"w"))){
+    general_error(13,layout_name);
+    return;
+  }
+  fprintf(f,"%s\n",LAYOUTMAGIC);
+  for(sec=first_section;sec;sec=sec->next){
+    fprintf(f,"S %s\n",sec->name);
+    for(p=sec->first;p;p=p->next){
+      if(p->changes>MAXSIZECHANGES)
+        break;
+    }
+    if(p!=NULL)
+      continue;  /* oscillating layout, always resolve cold */
+    for(p=sec->first;p;p=p->next){
+      if(p->type==LABEL){
+        fprintf(f,"L %llx %s\n",ULLTADDR(p->content.label->pc),
+                p->content.label->name);
+      }
+      else{
+        /* "<type> <size>", formatted by hand as this is the bulk */
+        size_t n=p->lastsize;
+        d=buf+sizeof(buf);
+        *--d='\n';
+        do{
+          *--d='0'+n%10;
+        }while(n/=10);
+        *--d=' ';
+        n=p->type;
+        do{
+          *--d='0'+n%10;
+        }while(n/=10);
+        fwrite(d,1,buf+sizeof(buf)-d,f);
+      }
+    }
+  }
+  if(fclose(f))
+    remove(layout_name);
+}
+
+static struct layrun *find_layrun(struct laysec *ls,struct layrun *run,
+                                  const char *name)
+{
+  hashdata data;
+
+  /* an unchanged source has its labels in the same order */
+  if(run!=NULL&&run->next!=NULL&&!strcmp(run->next->name,name))
+    return run->next;
+  if(ls->runs==NULL){
+    ls->runs=new_hashtable(ls->nruns+ls->nruns/2);
+    for(run=ls->start.next;run;run=run->next){
+      data.ptr=run;
+      add_hashentry(ls->runs,run->name,data);
+    }
+  }
+  return find_name(ls->runs,name,&data)?data.ptr:NULL;
+}
+
+/* seed atom sizes and label addresses from a previous layout */
+static void load_layout(void)
+{
+  struct laysec *ls,*firstls=NULL;
+  struct layrun *run=NULL,*lastrun;
+  section *sec;
+  char *buf,*s,*end;
+  size_t size,k;
+  atom *p;
+  FILE *f;
+
+  if(!(f=fopen(layout_name,"rb")))
+    return;  /* no previous build */
+  size=filesize(f);
+  buf=mymalloc(size+1);
+  if(fread(buf,1,size,f)!=size)
+    size=0;
+  fclose(f);
+  buf[size]='\0';
+
+  /* split into lines, build the sections and runs */
+  s=buf;
+  end=buf+size;
+  if(size>=sizeof(LAYOUTMAGIC)&&!strncmp(s,LAYOUTMAGIC"\n",sizeof(LAYOUTMAGIC))){
+    for(s+=sizeof(LAYOUTMAGIC);s<end;s++){
+      char *line=s;
+      if((s=memchr(s,'\n',end-s))==NULL)
+        s=end;
+      *s='\0';
+      if(*line=='S'&&line[1]==' '){
+        ls=mycalloc(sizeof(struct laysec));
+        ls->name=line+2;
+        ls->last=&ls->start;
+        ls->next=firstls;
+        firstls=ls;
+        run=&ls->start;
+      }
+      else if(*line=='L'&&line[1]==' '&&firstls!=NULL){
+        utaddr pc;
+
+        for(pc=0,line+=2;isxdigit((unsigned char)*line);line++)
+          pc=(pc<<4)+(isdigit((unsigned char)*line)?*line-'0':
+                      tolower((unsigned char)*line)-'a'+10);
+        run=mycalloc(sizeof(struct layrun));
+        run->pc=(taddr)pc;
+        run->name=*line?line+1:line;
+        firstls->last->next=run;
+        firstls->last=run;
+        firstls->nruns++;
+      }
+      else if(*line>='0'&&*line<='9'&&run!=NULL){
+        if(run->atoms==NULL)
+          run->atoms=line;
+        run->n++;
+      }
+    }
+  }
+
+  for(sec=first_section;sec;sec=sec->next){
+    for(ls=firstls;ls;ls=ls->next){
+      if(!strcmp(ls->name,sec->name))
+        break;
+    }
+    if(ls==NULL)
+      continue;
+    run=lastrun=&ls->start;
+    for(p=sec->first,k=0,s=run->atoms;p;p=p->next){
+      if(p->type==LABEL){
+        symbol *label=p->content.label;
+        if(run=find_layrun(ls,lastrun,label->name)){
+          lastrun=run;
+          if(label->type==LABSYM)
+            label->pc=run->pc;
+        }
+        k=0;
+        s=run?run->atoms:NULL;
+      }
+      else if(run!=NULL){
+        if(k<run->n&&strtoul(s,&s,10)==p->type){
+          p->lastsize=(size_t)strtoul(s,&s,10);
+          s+=strlen(s)+1;
+          k++;
+        }
+        else
+          run=NULL;  /* changed source, stop seeding this run */
+      }
+    }
+  }
+
+  while(ls=firstls){
+    firstls=ls->next;
+    while(run=ls->start.next){
+      ls->start.next=run->next;
+      myfree(run);
+    }
+    if(ls->runs)
+      free_hashtable(ls->runs);
+    myfree(ls);
+  }
+  myfree(buf);
+}
+
 static void resolve(void)
 {
   section *sec;
   bvtype *todo;
-  int finished;
+  int finished,resolved,force;
 
   final_pass=0;
   if(debug)
@@ -375,34 +1037,273 @@ static void resolve(void)
   for(num_secs=0, sec=first_section;sec;sec=sec->next)
     sec->idx=num_secs++;
 
+  /* fold forward-referenced equates and start caching symbol values */
+  fold_equates();
+  symval_epoch=1;
+
+  if(profile){
+    /* indexed by sec->idx, which is the section's position until output */
+    prof_sec=mycalloc((num_secs?num_secs:1)*sizeof(*prof_sec));
+    prof_nsecs=num_secs;
+  }
   todo=mymalloc(BVSIZE(num_secs));
   memset(todo,~(bvtype)0,BVSIZE(num_secs));
 
+  force=0;
   do{
     finished=1;
+    resolved=0;
+    if(HAVE_THREADSAFE_EVAL&&threads>1&&!debug&&!force&&
+       resolve_round(todo)){
+      finished=0;
+      continue;  /* next round, or the serial loop for the rest */
+    }
     for(sec=first_section;sec;sec=sec->next)
       if(BTST(todo, sec->idx)){
-	int passes;
+	int passes,moved=0;
+	unsigned pinned=0;
+	clock_t t0;
 	finished=0;
-	passes = resolve_section(sec);
-	BCLR(todo, sec->idx);
-	if(passes>1){
-	  if(sec->deps)
-	    bvunite(todo, sec->deps, BVSIZE(num_secs));
-	}
+	if(depresolve&&!force&&resolve_waits(sec,todo))
+	  continue;
+	force=0;
+	resolved++;
+	t0=profile?clock():0;
+	passes = resolve_section(sec,&pinned,&moved);
+	resolved_section(sec,todo,passes,moved,pinned,profile?clock()-t0:0);
       }
+    force=!resolved;  /* sections depend on each other, take the first one */
   }while(!finished);
 }
 
+/* Append the contents of DATA atom p to the DATA atom pp preceding it,
+   then remove p. cap is the allocated size of pp's data, which grows
+   by doubling. */
+static void coalesce_data(section *sec,atom *pp,atom *p,size_t *cap)
+{
+  dblock *db=pp->content.db;
+  dblock *pdb=p->content.db;
+
+  if(pdb->size){
+    if(db->size+pdb->size>*cap){
+      *cap=2*(db->size+pdb->size);
+      db->data=myrealloc(db->data,*cap);
+    }
+    memcpy(db->data+db->size,pdb->data,pdb->size);
+    db->size+=pdb->size;
+    pp->lastsize=db->size;
+  }
+  pp->next=p->next;
+  if(sec->last==p)
+    sec->last=pp;
+  myfree(pdb->data);
+  myfree(pdb);
+}
+
+/* Final pass with worker threads (-threads): before the serial loop of
+   assemble() enters a run of atoms without OPTS, RORG or RORGEND atoms,
+   the instructions and data definitions of the run are evaluated by the
+   workers, on a copy of the instruction or operand. Any message, and
+   anything which depends on the order of the atoms, makes a worker give
+   up its atom (see error_trap). The serial loop takes a result when its
+   atom is at the expected address, and evaluates the atom itself
+   otherwise, so messages, listing and DWARF lines keep their order.
+   The memory a worker allocates and frees for an atom is recorded in
+   the atom's memlog, to be released when its result is dropped or
+   taken (see mem_log). Workers first set the cpu options from the OPTS
+   atoms in front of the run, as the serial loop did. Workers look up symbols only in the snapshot
+   taken by freeze_symbols(), which is not modified while they run.
+   A symbol which is missing there sends the atom to the serial loop. */
+struct fpjob {
+  atom *atom;
+  taddr pc;
+  dblock *db;  /* NULL: evaluated by the serial loop */
+  memlog mem;
+};
+static struct fpjob *fpjobs;
+static size_t fpnjobs,fpmax,fpnext,fptaken;
+static section *fpsec;
+#define FPCHUNK 64      /* atoms taken by a worker at once */
+#define FPMINJOBS 1024  /* smaller runs are not worth starting threads */
+
+static void fp_eval(struct fpjob *j)
+{
+  jmp_buf trap;
+  atom *p=j->atom;
+  size_t i;
+#if MAX_OPERANDS!=0
+  operand op[MAX_OPERANDS];
+#endif
+  operand dop;
+
+  if(setjmp(trap)){
+    error_trap=NULL;
+    mem_log=NULL;
+    rollback_mem(&j->mem);
+    reset_eval(0);
+    return;  /* left to the serial loop */
+  }
+  error_trap=&trap;
+  mem_log=&j->mem;
+  if(p->type==INSTRUCTION){
+    instruction ip=*p->content.inst;
+#if MAX_OPERANDS!=0
+    for(i=0;i<MAX_OPERANDS;i++){
+      if(ip.op[i]!=NULL){
+        op[i]=*ip.op[i];
+        ip.op[i]=&op[i];
+      }
+    }
+#endif
+    j->db=eval_instruction(&ip,fpsec,j->pc);
+  }
+  else{
+    dop=*p->content.defb->op;
+    j->db=eval_data(&dop,p->content.defb->bitsize,fpsec,j->pc);
+  }
+  error_trap=NULL;
+  mem_log=NULL;
+
+  /* operands freed by the worker are the copies of the atom's operands */
+  for(i=0;i<j->mem.n;i++){
+    void **obj=&j->mem.e[i].obj;
+    if(p->type==INSTRUCTION){
+#if MAX_OPERANDS!=0
+      int k;
+      for(k=0;k<MAX_OPERANDS;k++){
+        if(*obj==&op[k])
+          *obj=p->content.inst->op[k];
+      }
+#endif
+    }
+    else if(*obj==&dop)
+      *obj=p->content.defb->op;
+  }
+}
+
+static void fp_worker(int n)
+{
+  size_t i,end;
+#if HAVE_CPU_OPTS
+  jmp_buf trap;
+  atom *p;
+
+  /* set the cpu options of the serial loop, but not the internal
+     symbols (see set_internal_abs()) */
+  if(setjmp(trap)){
+    error_trap=NULL;
+    leave_worker(n);
+    return;
+  }
+  error_trap=&trap;
+  for(p=fpsec->first;p!=fpjobs[0].atom;p=p->next){
+    if(p->type==OPTS)
+      cpu_opts(p->content.opts);
+  }
+  error_trap=NULL;
+#endif
+
+  for(;;){
+    lock_threads();
+    i=fptaken;
+    fptaken+=FPCHUNK;
+    unlock_threads();
+    if(i>=fpnjobs)
+      break;
+    for(end=i+FPCHUNK<fpnjobs?i+FPCHUNK:fpnjobs;i<end;i++)
+      fp_eval(&fpjobs[i]);
+  }
+  leave_worker(n);
+}
+
+/* release the results which were not taken by the serial loop */
+static void fp_drop(void)
+{
+  for(;fpnext<fpnjobs;fpnext++){
+    fpjobs[fpnext].db=NULL;
+    rollback_mem(&fpjobs[fpnext].mem);
+  }
+  fpnjobs=fpnext=0;
+}
+
+/* evaluate the run of atoms starting with p at pc by worker threads */
+static void fp_run(section *sec,atom *p,taddr pc)
+{
+  unsigned long epoch=symval_epoch;
+
+  fp_drop();
+  fptaken=0;
+  if(!own_cpu_opts(sec))
+    return;
+  for(;p;p=p->next){
+    if(p->type==OPTS||p->type==RORG||p->type==RORGEND)
+      break;
+    pc=pcalign(p,pc);
+    if((p->type==INSTRUCTION||p->type==DATADEF)&&
+       p->changes<=MAXSIZECHANGES){
+      if(fpnjobs>=fpmax){
+        fpmax=fpmax?fpmax*2:FPMINJOBS;
+        fpjobs=myrealloc(fpjobs,fpmax*sizeof(struct fpjob));
+      }
+      fpjobs[fpnjobs].atom=p;
+      fpjobs[fpnjobs].pc=pc;
+      fpjobs[fpnjobs].db=NULL;
+      fpjobs[fpnjobs].mem.e=NULL;
+      fpjobs[fpnjobs].mem.n=fpjobs[fpnjobs].mem.max=0;
+      fpnjobs++;
+    }
+    pc+=p->lastsize;
+  }
+  if(fpnjobs<FPMINJOBS){
+    fpnjobs=0;
+    return;
+  }
+  fpsec=sec;
+  freeze_symbols();  /* the only symbol table workers may read */
+  symval_epoch=0;  /* workers don't use the value cache of shared symbols */
+  if(!run_threads(threads,fp_worker))
+    threads=1;
+  symval_epoch=epoch;
+  num_mallocs+=thread_mallocs;
+  thread_mallocs=0;
+}
+
+/* result of the worker for atom p at pc, or NULL */
+static dblock *fp_result(atom *p,taddr pc)
+{
+  struct fpjob *j;
+
+  if(fpnext<fpnjobs&&fpjobs[fpnext].atom==p){
+    j=&fpjobs[fpnext++];
+    if(j->pc==pc&&j->db!=NULL){
+      commit_mem(&j->mem);
+      return j->db;
+    }
+    rollback_mem(&j->mem);
+  }
+  return NULL;
+}
+
+/* Final pass: convert instructions and data definitions into DATA atoms.
+   It has to run in source order, even with all labels fixed. OPTS atoms
+   change cpu options for the following atoms, RORG blocks, listing and
+   DWARF line information depend on the previous atoms, and messages
+   are reported through cur_src.
+   Runs of reloc-free data definitions without labels or alignment gaps
+   between them are coalesced into a single DATA atom, unless they are
+   part of a listing or the output module needs the source line of
+   every atom (no_coalesce). */
 static void assemble(void)
 {
   taddr basepc,rorg_pc,org_pc;
   struct dwarf_info dinfo;
-  int bss,rorg;
+  int bss,rorg,newrun;
   section *sec;
-  atom *p,*pp;
+  atom *p,*pp,*run;
+  size_t runcap;
 
   convert_offset_labels();
+  symval_epoch++;  /* offset labels converted, errors are reported now */
   if(dwarf){
     dinfo.version=dwarf;
     dinfo.producer=cnvstr(copyright,strchr(copyright,'(')-copyright-1);
@@ -416,8 +1317,17 @@ static void assemble(void)
     int lasterrline=0,ovflw=0;
     sec->pc=sec->org;
     bss=strchr(sec->attr,'u')!=NULL;
+    run=NULL;
+    runcap=0;
+    newrun=1;
     for(p=sec->first,pp=NULL;p;p=p->next){
+      int fromdef=0;
       basepc=sec->pc;
+      if(newrun){
+        if(HAVE_THREADSAFE_EVAL&&threads>1&&!rorg&&!debug)
+          fp_run(sec,p,sec->pc);
+        newrun=0;
+      }
       sec->pc=pcalign(p,sec->pc);
       if(cur_src=p->src)
         cur_src->line=p->line;
@@ -444,7 +1354,7 @@ static void assemble(void)
       else if(rorg)
         p->align=1;  /* disable ineffective alignment in relocated org block */
       if(p->type==RORG){
-        rorg_pc=*p->content.rorg;
+        rorg_pc=p->content.rorg;
         org_pc=sec->pc;
         sec->pc=rorg_pc;
         sec->flags|=ABSOLUTE;
@@ -470,7 +1380,7 @@ static void assemble(void)
           if(db->size!=sz)
             ierror(0);
         }
-        else
+        else if((db=fp_result(p,sec->pc))==NULL)
           db=eval_instruction(p->content.inst,sec,sec->pc);
         if(pic_check)
           do_pic_check(db->relocs);
@@ -482,22 +1392,21 @@ static void assemble(void)
           else
             dwarf_line(&dinfo,sec,cur_src->srcfile->index,cur_src->line);
         }
-        /*FIXME: sauber freigeben */
-        myfree(p->content.inst);
         p->content.db=db;
         p->type=DATA;
       }
       else if(p->type==DATADEF){
         dblock *db;
         cur_listing=p->list;
-        db=eval_data(p->content.defb->op,p->content.defb->bitsize,sec,sec->pc);
+        if((db=fp_result(p,sec->pc))==NULL)
+          db=eval_data(p->content.defb->op,p->content.defb->bitsize,
+                       sec,sec->pc);
         if(pic_check)
           do_pic_check(db->relocs);
         cur_listing=0;
-        /*FIXME: sauber freigeben */
-        myfree(p->content.defb);
         p->content.db=db;
         p->type=DATA;
+        fromdef=1;
       }
       else if(p->type==ROFFS)
         roffs_to_space(sec,p);
@@ -524,6 +1433,8 @@ static void assemble(void)
         new_stabdef(p->content.nlist,sec);
       else if(p->type==VASMDEBUG)
         vasmdebug("assemble",sec,p);
+      if(p->type==OPTS||p->type==RORGEND)
+        newrun=1;
       if(p->type==DATA&&bss){
         if(lasterrsrc!=p->src||lasterrline!=p->line){
           if(sec->flags&UNALLOCATED){
@@ -544,6 +1455,16 @@ static void assemble(void)
         ovflw=sec->pc==0;
       }
       sec->flags&=~RESOLVE_WARN;
+      if(fromdef&&!bss&&!no_coalesce&&p->list==NULL&&
+         p->content.db->relocs==NULL){
+        if(pp==run&&pcalign(p,basepc)==basepc){
+          coalesce_data(sec,pp,p,&runcap);
+          p=pp;  /* continue behind the removed atom */
+          continue;
+        }
+        run=p;
+        runcap=p->content.db->size;
+      }
       pp=p;  /* prev atom */
     }
     /* leave RORG-mode, when section ends */
@@ -556,11 +1477,31 @@ static void assemble(void)
     if(dwarf)
       dwarf_end_sequence(&dinfo,sec);
   }
+  fp_drop();
+  myfree(fpjobs);
+  fpjobs=NULL;
+  fpmax=0;
   remove_unalloc_sects();
   if(dwarf)
     dwarf_finish(&dinfo);
 }
 
+/* buffer the output file with the estimated size of its image */
+static void set_outbuf(FILE *f)
+{
+  section *sec;
+  size_t n=OUTBUFSLACK;
+
+  for(sec=first_section;sec&&n<OUTBUFMAX;sec=sec->next)
+    n+=(utaddr)(sec->pc-sec->org)<OUTBUFMAX?(utaddr)(sec->pc-sec->org):OUTBUFMAX;
+  if(n>OUTBUFMAX)
+    n=OUTBUFMAX;
+  if(n>BUFSIZ){
+    outbuf=mymalloc(n);
+    setvbuf(f,outbuf,_IOFBF,n);
+  }
+}
+
 static void undef_syms(void)
 {
   symbol *sym;
@@ -650,6 +1591,135 @@ static void statistics(void)
   }
 }
 
+static void profile_start(void)
+{
+  if(profile)
+    prof_start=clock();
+}
+
+static void profile_stop(int phase)
+{
+  if(profile)
+    prof_time[phase]+=clock()-prof_start;
+}
+
+static void profile_atoms(void)
+{
+  section *sec;
+  atom *p;
+
+  for(sec=first_section;sec;sec=sec->next)
+    for(p=sec->first;p;p=p->next)
+      if(p->type<=NLIST)
+        prof_atoms[p->type]++;
+}
+
+static double cpusecs(clock_t t)
+{
+  return (double)t/CLOCKS_PER_SEC;
+}
+
+static void print_jsonstr(FILE *f,const char *s)
+{
+  fputc('"',f);
+  for(;*s;s++){
+    if(*s=='"'||*s=='\\')
+      fprintf(f,"\\%c",*s);
+    else if((unsigned char)*s<' ')
+      fprintf(f,"\\u%04x",(unsigned char)*s);
+    else
+      fputc(*s,f);
+  }
+  fputc('"',f);
+}
+
+static void print_profile_json(FILE *f)
+{
+  unsigned long pallocs=0;
+  hashtable *ht;
+  mempool *mp;
+  section *sec;
+  int i;
+
+  fprintf(f,"{\n  \"total\": %.6f,\n  \"phases\": {\n"
+          "    \"read\": %.6f",cpusecs(clock()),cpusecs(srcread_time));
+  for(i=0;i<PROF_PHASES;i++)
+    fprintf(f,",\n    \"%s\": %.6f",prof_phasename[i],cpusecs(prof_time[i]));
+  fprintf(f,"\n  },\n  \"sections\": [");
+  for(i=0,sec=first_section;sec&&i<prof_nsecs;sec=sec->next,i++){
+    fprintf(f,"%s\n    { \"name\": ",i?",":"");
+    print_jsonstr(f,sec->name);
+    fprintf(f,", \"resolves\": %d, \"passes\": %d, \"pinned\": %u,"
+            " \"time\": %.6f }",prof_sec[i].resolves,prof_sec[i].passes,
+            prof_sec[i].pinned,cpusecs(prof_sec[i].time));
+  }
+  fprintf(f,"\n  ],\n  \"hashtables\": [");
+  for(ht=first_named_hashtable;ht;ht=ht->nextnamed)
+    fprintf(f,"%s\n    { \"name\": \"%s\", \"entries\": %lu, \"size\": %lu,"
+            " \"lookups\": %lu, \"collisions\": %d }",
+            ht==first_named_hashtable?"":",",ht->name,(unsigned long)ht->used,
+            (unsigned long)ht->size,ht->lookups,ht->collisions);
+  for(mp=first_pool;mp;mp=mp->nextpool)
+    pallocs+=mp->allocs;
+  fprintf(f,"\n  ],\n  \"macro_calls\": %lu,\n  \"mallocs\": %lu,\n"
+          "  \"pool_allocs\": %lu,\n  \"atoms\": {",
+          num_macro_calls,num_mallocs,pallocs);
+  for(i=0;i<=NLIST;i++)
+    fprintf(f,"%s\n    \"%s\": %lu",i?",":"",prof_atomname[i],prof_atoms[i]);
+  fprintf(f,"\n  }\n}\n");
+}
+
+static void print_profile(void)
+{
+  unsigned long pallocs=0;
+  hashtable *ht;
+  mempool *mp;
+  section *sec;
+  FILE *f;
+  int i;
+
+  if(prof_filename){
+    if(f=fopen(prof_filename,"w")){
+      print_profile_json(f);
+      fclose(f);
+    }
+    else
+      general_error(13,prof_filename);
+    return;
+  }
+
+  printf("\nProfile (cpu seconds):\n");
+  printf("%-24s %10.3f\n","read sources",cpusecs(srcread_time));
+  for(i=0;i<PROF_PHASES;i++)
+    printf("%-24s %10.3f\n",prof_phasename[i],cpusecs(prof_time[i]));
+  printf("%-24s %10.3f\n","total",cpusecs(clock()));
+
+  if(prof_nsecs){
+    printf("\n%-24s %10s %10s %10s %10s\n",
+           "section","resolves","passes","pinned","seconds");
+    for(i=0,sec=first_section;sec&&i<prof_nsecs;sec=sec->next,i++)
+      printf("%-24s %10d %10d %10u %10.3f\n",sec->name,prof_sec[i].resolves,
+             prof_sec[i].passes,prof_sec[i].pinned,cpusecs(prof_sec[i].time));
+  }
+
+  printf("\n%-24s %10s %10s %10s %10s\n",
+         "hash table","entries","size","lookups","collisions");
+  for(ht=first_named_hashtable;ht;ht=ht->nextnamed)
+    printf("%-24s %10lu %10lu %10lu %10d\n",ht->name,(unsigned long)ht->used,
+           (unsigned long)ht->size,ht->lookups,ht->collisions);
+
+  for(mp=first_pool;mp;mp=mp->nextpool)
+    pallocs+=mp->allocs;
+  printf("\n%-24s %10lu\n","macro calls",num_macro_calls);
+  printf("%-24s %10lu\n","mallocs",num_mallocs);
+  printf("%-24s %10lu\n","pool allocs",pallocs);
+
+  printf("\n%-24s %10s\n","atom type","count");
+  for(i=0;i<=NLIST;i++)
+    if(prof_atoms[i])
+      printf("%-24s %10lu\n",prof_atomname[i],prof_atoms[i]);
+}
+
 static struct {
   const char *name;
   int executable;
@@ -693,6 +1763,7 @@ static int init_main(void)
   const char *mname;
   hashdata data;
   mnemohash=new_hashtable(MNEMOHTABSIZE);
+  name_hashtable(mnemohash,"mnemonics");
   i=0;
   while(i<mnemonic_cnt){
     data.idx=i;
@@ -711,6 +1782,191 @@ static int init_main(void)
   return 1;
 }
 
+/* define a symbol from a -D<name>[=<expression>] option */
+static int cmdline_define(char *def)
+{
+  static strbuf buf;
+  char *s=def;
+  expr *val;
+
+  if(ISIDSTART(*s)){
+    s++;
+    while(ISIDCHAR(*s))
+      s++;
+    def=cutstr(&buf,def,s-def);
+    if(*s=='='){
+      s++;
+      val=parse_expr(&s);
+    }
+    else
+      val=number_expr(1);
+    if(*s)
+      general_error(23,'D');  /* trailing garbage after option */
+    new_equate(def,val);
+    return 1;
+  }
+  return 0;
+}
+
+static void init_modules(void)
+{
+  if(!init_parse())
+    general_error(10,"parse");
+  if(!init_syntax())
+    general_error(10,"syntax");
+  if(dirhash)
+    name_hashtable(dirhash,"directives");
+  if(!init_cpu())
+    general_error(10,"cpu");
+  set_taddr();  /* update taddr mask/min/max */
+}
+
+static const char job_blanks[]=" \t\r\n";
+
+/* Take source and output names of a job from a line. Returns 1 for a job,
+   0 for an empty line or a comment and -1 for a missing output name. */
+static int job_names(char *line)
+{
+  if((inname=strtok(line,job_blanks))==NULL||*inname=='#')
+    return 0;
+  if((outname=strtok(NULL,job_blanks))==NULL)
+    return -1;
+  return 1;
+}
+
+/* Start the job from job_names() in a copy of this process, which
+   inherits all tables built so far. The copy defines the symbols from
+   the remaining -D options of the line. Its standard output and error
+   go to outfd, unless negative. Returns 0 in the copy. */
+static int start_job(FILE *out)
+{
+  char *opt;
+  int r=fork_job(out);
+
+  if(r==0){
+    while(opt=strtok(NULL,job_blanks)){
+      inccache_key(opt);
+      if(strncmp("-D",opt,2)||!cmdline_define(opt+2))
+        general_error(14,opt);  /* unknown option */
+    }
+  }
+  else if(r<0)
+    general_error(92);  /* batch mode not supported */
+  return r;
+}
+
+/* -batch: run a job for every line of the batch file, up to batch_jobs
+   of them at the same time. Returns in the process of a job only. */
+static void run_batch(void)
+{
+  FILE *f;
+  char *text,*line,*next;
+  size_t size;
+  int lineno=0,running=0,failed=0,r;
+
+  /* read all jobs first, as the copies share the file position */
+  if(!(f=fopen(batch_filename,"rb")))
+    general_error(12,batch_filename);
+  size=filesize(f);
+  text=mymalloc(size+1);
+  text[fread(text,1,size,f)]='\0';
+  fclose(f);
+
+  for(line=text;*line;line=next){
+    if(next=strchr(line,'\n'))
+      *next++='\0';
+    else
+      next=line+strlen(line);
+    lineno++;
+    if((r=job_names(line))<=0){
+      if(r<0){
+        general_error(93,lineno,batch_filename);  /* missing output file */
+        failed++;
+      }
+      continue;
+    }
+    for(;running>=batch_jobs;running--){
+      if(wait_job()!=0)
+        failed++;
+    }
+    if(start_job(NULL)==0)
+      return;
+    running++;
+  }
+  while((r=wait_job())>=0)
+    failed+=r;
+  exit(failed?EXIT_FAILURE:EXIT_SUCCESS);
+}
+
+/* copy the contents of a temporary file to stdout and close it */
+static void send_tmpfile(FILE *f)
+{
+  char buf[4096];
+  size_t n;
+
+  rewind(f);
+  while((n=fread(buf,1,sizeof(buf),f))>0)
+    fwrite(buf,1,n,stdout);
+  fclose(f);
+}
+
+static unsigned long tmpfile_size(FILE *f)
+{
+  fseek(f,0,SEEK_END);
+  return (unsigned long)ftell(f);
+}
+
+/* -daemon: read jobs from stdin, formatted like the lines of a batch
+   file, and run them one after another. Every job is answered on stdout
+   by a line with "ok" or "failed", its output file name, the size of
+   its messages and the size of its output, followed by the messages and
+   the output. The output is only returned for the output file name "-",
+   otherwise it is written to the file. Source and include cache files
+   read by a job are kept in memory for the following jobs. Returns in
+   the process of a job only. */
+static void run_daemon(void)
+{
+  static char line[BATCHLINELEN];
+  FILE *msgf=NULL,*repf=NULL;
+  char *path;
+  int r;
+
+  while(fgets(line,BATCHLINELEN,stdin)){
+    if((r=job_names(line))==0)
+      continue;
+    if(!(msgf=tmpfile())||!(repf=tmpfile()))
+      general_error(13,"tmpfile");
+    job_objfile=NULL;
+    if(r>0){
+      if(!strcmp(outname,"-")&&!(job_objfile=tmpfile()))
+        general_error(13,"tmpfile");
+      refresh_warm_sources();
+      job_report=repf;
+      if(start_job(msgf)==0)
+        return;
+      job_report=NULL;
+      r=wait_job();
+    }
+    else
+      r=1;  /* missing output file name */
+    printf("%s %s %lu %lu\n",r==0?"ok":"failed",outname?outname:inname,
+           tmpfile_size(msgf),job_objfile?tmpfile_size(job_objfile):0UL);
+    send_tmpfile(msgf);
+    if(job_objfile)
+      send_tmpfile(job_objfile);
+    fflush(stdout);
+
+    /* keep the files of this job in memory, while waiting for the next */
+    rewind(repf);
+    while(fgets(line,BATCHLINELEN,repf)){
+      if(path=strtok(line,"\r\n"))
+        warm_source(path);
+    }
+    fclose(repf);
+  }
+  exit(EXIT_SUCCESS);
+}
+
 static void include_main_source(void)
 {
   if (inname) {
@@ -893,6 +2149,7 @@ section *new_section(char *name,char *attr,int align)
   p->org=p->pc=0;
   p->flags=0;
   p->memattr=0;
+  p->atoms.next=p->atoms.end=NULL;
   memset(p->pad,0,MAXPADBYTES);
   if(sec_padding)
     p->padbytes=make_padding(sec_padding,p->pad,MAXPADBYTES);
@@ -1112,7 +2369,6 @@ static void set_defaults(void)
 
 int main(int argc,char **argv)
 {
-  static strbuf buf;
   int i;
   for(i=1;i<argc;i++){
     if(argv[i][0]=='-'&&argv[i][1]=='F'){
@@ -1144,6 +2400,9 @@ int main(int argc,char **argv)
     if(verbose==2)  /* -v */
       leave();
   }
+  inccache_key(copyright);
+  inccache_key(cpu_copyright);
+  inccache_key(syntax_copyright);
   for(i=1;i<argc;i++){
     if(argv[i][0]==0)
       continue;
@@ -1153,6 +2412,14 @@ int main(int argc,char **argv)
       inname=argv[i];
       continue;
     }
+    if(strcmp("-o",argv[i])&&strcmp("-depfile",argv[i])&&
+       strncmp("-L",argv[i],2)&&strncmp("-I",argv[i],2)&&
+       strncmp("-depend",argv[i],7)&&strncmp("-inccache=",argv[i],10)&&
+       strncmp("-profile",argv[i],8)&&strcmp("-exprcode",argv[i])&&
+       strcmp("-exprcheck",argv[i])&&strncmp("-batch=",argv[i],7)&&
+       strncmp("-jobs=",argv[i],6)&&strcmp("-daemon",argv[i])&&
+       strncmp("-layout=",argv[i],8)&&strncmp("-threads=",argv[i],9))
+      inccache_key(argv[i]);  /* options which may influence parsing */
     if(!strcmp("-o",argv[i])&&i<argc-1){
       if(outname)
         general_error(28,argv[i]);
@@ -1173,30 +2440,12 @@ int main(int argc,char **argv)
     }
     if(!strncmp("-D",argv[i],2)){
       char *def=NULL;
-      expr *val;
       if(argv[i][2])
         def=&argv[i][2];
       else if (i<argc-1)
         def=argv[++i];
-      if(def){
-        char *s=def;
-        if(ISIDSTART(*s)){
-          s++;
-          while(ISIDCHAR(*s))
-            s++;
-          def=cutstr(&buf,def,s-def);
-          if(*s=='='){
-            s++;
-            val=parse_expr(&s);
-          }
-          else
-            val=number_expr(1);
-          if(*s)
-            general_error(23,'D');  /* trailing garbage after option */
-          new_equate(def,val);
-          continue;
-        }
-      }
+      if(def&&cmdline_define(def))
+        continue;
     }
     if(!strncmp("-I",argv[i],2)){
       char *path=NULL;
@@ -1220,6 +2469,30 @@ int main(int argc,char **argv)
         continue;
       }
     }
+    if(!strncmp("-batch=",argv[i],7)){
+      batch_filename=argv[i]+7;
+      continue;
+    }
+    if(!strncmp("-layout=",argv[i],8)){
+      layout_name=argv[i]+8;
+      continue;
+    }
+    if(!strcmp("-daemon",argv[i])){
+      daemon_mode=1;
+      continue;
+    }
+    if(!strncmp("-jobs=",argv[i],6)){
+      sscanf(argv[i]+6,"%i",&batch_jobs);
+      if(batch_jobs<1)
+        batch_jobs=1;
+      continue;
+    }
+    if(!strncmp("-threads=",argv[i],9)){
+      sscanf(argv[i]+9,"%i",&threads);
+      if(threads<1)
+        threads=1;
+      continue;
+    }
     if(!strcmp("-depfile",argv[i])&&i<argc-1){
       if(dep_filename)
         general_error(28,argv[i]);
@@ -1242,6 +2515,22 @@ int main(int argc,char **argv)
       sscanf(argv[i]+14,"%i",&maxmacrecurs);
       continue;
     }
+    if(!strncmp("-inccache=",argv[i],10)){
+      inccache_dir=argv[i]+10;
+      continue;
+    }
+    if(!strcmp("-depresolve",argv[i])){
+      depresolve=1;
+      continue;
+    }
+    if(!strcmp("-incresolve",argv[i])){
+      incresolve=1;
+      continue;
+    }
+    if(!strcmp("-pinosc",argv[i])){
+      pinosc=1;
+      continue;
+    }
     if(!strncmp("-maxpasses=",argv[i],11)){
       sscanf(argv[i]+11,"%i",&maxpasses);
       continue;
@@ -1270,6 +2559,27 @@ int main(int argc,char **argv)
       disable_warning(wno);
       continue;
     }
+    if(!strcmp("-exprcode",argv[i])){
+      exprcode=1;
+      continue;
+    }
+    if(!strcmp("-exprcheck",argv[i])){
+      exprcode=2;
+      continue;
+    }
+    if(!strcmp("-profile",argv[i])){
+      profile=1;
+      continue;
+    }
+    if(!strncmp("-profile=",argv[i],9)){
+      profile=1;
+      prof_filename=argv[i]+9;
+      continue;
+    }
+    if(!strcmp("-stats",argv[i])){
+      memstats=1;
+      continue;
+    }
     if(!strcmp("-unsshift",argv[i])){
       unsigned_shift=1;
       continue;
@@ -1331,37 +2641,64 @@ int main(int argc,char **argv)
     }
     general_error(14,argv[i]);
   }
-  if(dwarf&&inname==NULL){
+  if((batch_filename||daemon_mode)&&(inname||outname))
+    general_error(11);  /* source and output are taken from the jobs */
+  if(dwarf&&inname==NULL&&!batch_filename&&!daemon_mode){
     dwarf=0;  /* no DWARF output when input source is from stdin */
     general_error(84);
   }
   if(errors) leave();
   nostdout=depend&&dep_filename==NULL; /* dependencies to stdout nothing else */
-  include_main_source();
-  internal_abs(vasmsym_name);
-  if(!init_parse())
-    general_error(10,"parse");
-  if(!init_syntax())
-    general_error(10,"syntax");
-  if(!init_cpu())
-    general_error(10,"cpu");
-  set_taddr();  /* update taddr mask/min/max */
+  if(batch_filename||daemon_mode){
+    layout_name=NULL;  /* jobs would share the same layout file */
+    internal_abs(vasmsym_name);
+    init_modules();
+    if(daemon_mode)
+      run_daemon();  /* returns as a job */
+    else
+      run_batch();
+    include_main_source();
+  }
+  else{
+    include_main_source();
+    internal_abs(vasmsym_name);
+    init_modules();
+  }
   set_defaults();
+  profile_start();
   parse();
   end_all_rorg();
+  profile_stop(PROF_PARSE);
+  freeze_symbols();
+  compile_exprs=exprcode;
   listena=0;
-  if(errors==0||produce_listing)
+  if(profile)
+    profile_atoms();
+  if(errors==0||produce_listing){
+    profile_start();
+    if(layout_name&&errors==0)
+      load_layout();
     resolve();
-  if(errors==0||produce_listing)
+    if(layout_name&&errors==0)
+      save_layout();
+    profile_stop(PROF_RESOLVE);
+  }
+  if(errors==0||produce_listing){
+    profile_start();
     assemble();
+    profile_stop(PROF_ASSEMBLE);
+  }
   cur_src=NULL;
+  symval_epoch=0;  /* no more symbol value caching */
   if(errors==0)
     undef_syms();
   fix_labels();
   if(produce_listing){
     if(!listname)
       listname="a.lst";
+    profile_start();
     write_listing(listname,first_section);
+    profile_stop(PROF_LISTING);
   }
   if(errors==0){
     if(depend&&dep_filename==NULL){
@@ -1384,11 +2721,19 @@ int main(int argc,char **argv)
       /* write the object file */
       if(!outname)
         outname="a.out";
-      outfile=fopen(outname,asciiout?"w":"wb");
+      if(job_objfile)
+        outfile=job_objfile;  /* returned by the daemon */
+      else
+        outfile=fopen(outname,asciiout?"w":"wb");
       if(!outfile)
         general_error(13,outname);
-      else
+      else{
+        set_outbuf(outfile);
+        profile_start();
         write_object(outfile,first_section,first_symbol);
+        fflush(outfile);  /* the buffered output is part of this phase */
+        profile_stop(PROF_OUTPUT);
+      }
     }
   }
   leave();
@@ -8,6 +8,15 @@
 #include <ctype.h>
 #include <string.h>
 #include <limits.h>
+#include <time.h>
+#include <setjmp.h>
+
+/* variables with a separate instance in every worker thread */
+#ifdef VASM_THREADS
+#define THREADLOCAL __thread
+#else
+#define THREADLOCAL
+#endif
 
 typedef struct atom atom;
 typedef struct dblock dblock;
@@ -20,6 +29,7 @@ typedef struct source source;
 typedef struct listing listing;
 typedef struct regsym regsym;
 typedef struct strsym strsym;
+typedef struct mempool mempool;
 
 typedef struct strbuf {
   size_t size;
@@ -55,6 +65,10 @@ typedef struct strbuf {
 #define MNEMONIC_VALID(i) 1
 #endif
 
+#ifndef HAVE_THREADSAFE_EVAL
+#define HAVE_THREADSAFE_EVAL 0
+#endif
+
 #ifndef OPERAND_OPTIONAL
 #define OPERAND_OPTIONAL(p,t) 0
 #endif
@@ -113,6 +127,7 @@ struct section {
   taddr org;
   taddr pc;
   unsigned long idx; /* usable by output module */
+  memchunk atoms;    /* block for the atoms created in this section */
 };
 
 /* mnemonic description */
@@ -132,12 +147,13 @@ typedef struct mnemonic {
 
 extern char *inname,*outname,*output_format,*defsectname,*defsecttype;
 extern taddr defsectorg,inst_alignment;
-extern int chklabels,nocase,no_symbols,pic_check,unnamed_sections;
+extern int chklabels,nocase,no_symbols,unnamed_sections;
+extern THREADLOCAL int pic_check;
 extern unsigned space_init;
-extern int asciiout,secname_attr,warn_unalloc_ini_dat;
+extern int asciiout,secname_attr,warn_unalloc_ini_dat,no_coalesce;
 extern hashtable *mnemohash;
 extern char *filename,*debug_filename;
-extern source *cur_src;
+extern THREADLOCAL source *cur_src;
 extern section *current_section,container_section;
 extern int num_secs,final_pass,exec_out,nostdout;
 extern struct stabdef *first_nlist,*last_nlist;
@@ -149,7 +165,7 @@ extern unsigned long long taddrmask;
 extern taddr taddrmin,taddrmax;
 
 /* provided by main assembler module */
-extern int debug;
+extern int debug,profile;
 
 void leave(void);
 void set_section(section *);
@@ -176,10 +192,15 @@ void print_section(FILE *,section *);
 #define setdebugname(x) debug_filename=(x)
 #define getdebugname() debug_filename
 
+/* provided by expr.c */
+extern THREADLOCAL bvtype *res_refs;
+
 /* provided by error.c */
 extern int errors,warnings;
+extern unsigned long error_calls;
 extern int max_errors;
-extern int no_warn;
+extern THREADLOCAL int no_warn;
+extern THREADLOCAL jmp_buf *error_trap;
 
 void general_error(int,...);
 void syntax_error(int,...);